@@ -0,0 +1,623 @@
+/*
+
+libxidle, the sampling core of xidletool: the DPMS corrected user idle
+time of a display through the screen saver extension, and IDLETIME
+alarms of the SYNC extension.
+
+Copyright (c) 2005, 2008 Magnus Henoch <henoch@dtek.chalmers.se>
+Copyright (c) 2006, 2007 by Danny Kukawka
+                         <dkukawka@suse.de>, <danny.kukawka@web.de>
+Copyright (c) 2008 Eivind Magnus Hvidevold <hvidevold@gmail.com>
+Copyright (c) 2014 Alex Alexander
+                   <wired@gentoo.org> <alex.alexander@gmail.com>
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+The function workaroundCreepyXServer was adapted from kpowersave-0.7.3 by
+Eivind Magnus Hvidevold <hvidevold@gmail.com>. kpowersave is licensed under
+the GNU GPL, version 2 _only_.
+
+*/
+
+/* seconds after which cached DPMS timeouts are considered stale */
+#define DPMS_REFRESH 60
+
+#include <X11/Xlib.h>
+#ifdef HAVE_DPMSSELECTINPUT
+#include <X11/Xlibint.h>
+#endif
+#include <X11/extensions/dpms.h>
+#include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
+#ifdef USE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/screensaver.h>
+#include <xcb/dpms.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+
+#include "xidle.h"
+
+struct dpmsCache {
+	bool capable;        /* DPMS extension present and display capable */
+	bool notify;         /* DPMSInfoNotify events are selected */
+	bool stale;          /* state or timeouts have to be re-read */
+	int opcode;          /* major opcode to match DPMS GenericEvents */
+	CARD16 standby, suspend, off;
+	CARD16 state;
+	BOOL onoff;
+	time_t refreshed;    /* CLOCK_MONOTONIC seconds of the last refresh */
+};
+
+struct xidle {
+	Display *dpy;
+	struct dpmsCache dpms;
+	int sync_event;          /* SYNC event base, valid if idleCounter is set */
+	XSyncCounter idleCounter;  /* IDLETIME, see findIdleCounter() */
+	unsigned long requests, roundtrips;
+	bool oneshot;            /* see xidle_attach_oneshot() */
+	bool all;                /* sample every screen, see xidle_all_screens() */
+	uint64_t *idle;          /* per screen, of the last sample */
+#ifdef USE_XCB
+	/* requests of a sample in flight, see xidle_sample_send() */
+	bool sent;               /* oneshot, the screen saver extension is there */
+	xcb_screensaver_query_info_cookie_t *ssc;  /* per screen */
+	xcb_dpms_info_cookie_t infoc;
+	xcb_dpms_get_timeouts_cookie_t timeoutsc;
+	bool info, timeouts;
+	bool prefetched;         /* oneshot, extension data has been asked for */
+#endif
+};
+
+static void probeDPMS(Display *dpy, struct dpmsCache *dpms);
+static unsigned long workaroundCreepyXServer(Display *dpy, struct dpmsCache *dpms, unsigned long _idleTime );
+static unsigned long correctDPMSIdleTime(const struct dpmsCache *dpms, unsigned long _idleTime);
+static bool findIdleCounter(struct xidle *x);
+static struct xidle *newHandle(Display *dpy);
+static void screenRange(const struct xidle *x, int *first, int *last);
+
+struct xidle *xidle_open(const char *display) {
+	Display *dpy = XOpenDisplay(display);
+	struct xidle *x;
+
+	if (dpy == NULL)
+		return NULL;
+	if (!(x = xidle_attach(dpy)))
+		XCloseDisplay(dpy);
+	return x;
+}
+
+/* the one time extension probes, done here instead of on every sample */
+struct xidle *xidle_attach(Display *dpy) {
+	struct xidle *x;
+	int event_basep, error_basep;
+
+	if (!XScreenSaverQueryExtension(dpy, &event_basep, &error_basep))
+		return NULL;
+	if (!(x = newHandle(dpy)))
+		return NULL;
+
+	probeDPMS(dpy, &x->dpms);
+	return x;
+}
+
+struct xidle *xidle_attach_oneshot(Display *dpy) {
+	struct xidle *x;
+
+	if (!(x = newHandle(dpy)))
+		return NULL;
+	x->oneshot = true;
+	return x;
+}
+
+static struct xidle *newHandle(Display *dpy) {
+	struct xidle *x;
+
+	if (!(x = calloc(1, sizeof(*x))))
+		return NULL;
+	x->dpy = dpy;
+	x->idle = calloc(ScreenCount(dpy), sizeof(*x->idle));
+#ifdef USE_XCB
+	x->ssc = calloc(ScreenCount(dpy), sizeof(*x->ssc));
+	if (!x->ssc) {
+		free(x->idle);
+		x->idle = NULL;
+	}
+#endif
+	if (!x->idle) {
+		free(x);
+		return NULL;
+	}
+	return x;
+}
+
+void xidle_close(struct xidle *x) {
+	if (!x)
+		return;
+	XCloseDisplay(x->dpy);
+	free(x->idle);
+#ifdef USE_XCB
+	free(x->ssc);
+#endif
+	free(x);
+}
+
+void xidle_all_screens(struct xidle *x) {
+	x->all = true;
+}
+
+uint64_t xidle_screen_idle(const struct xidle *x, int screen) {
+	return x->idle[screen];
+}
+
+/* the screens a sample covers, from first to before last */
+static void screenRange(const struct xidle *x, int *first, int *last) {
+	*first = x->all ? 0 : DefaultScreen(x->dpy);
+	*last = x->all ? ScreenCount(x->dpy) : *first + 1;
+}
+
+Display *xidle_display(struct xidle *x) {
+	return x->dpy;
+}
+
+int xidle_sample(struct xidle *x, uint64_t *idle_ms) {
+	xidle_sample_send(x);
+	return xidle_sample_recv(x, idle_ms);
+}
+
+#ifndef USE_XCB
+/* Xlib can't split a request from its reply, see xidle_sample_recv() */
+void xidle_sample_send(struct xidle *x) {
+	(void) x;
+}
+
+int xidle_sample_recv(struct xidle *x, uint64_t *idle_ms) {
+	XScreenSaverInfo ssi;
+	unsigned long before = XNextRequest(x->dpy);
+	struct dpmsCache *dpms = &x->dpms;
+	int first, last, i, dummy;
+
+	screenRange(x, &first, &last);
+	for (i = first; i < last; i++) {
+		if (!XScreenSaverQueryInfo(x->dpy, RootWindow(x->dpy, i), &ssi))
+			return -1;
+		x->idle[i] = ssi.idle;
+	}
+
+	/* DPMS is per server, so the first screen refreshes it for all */
+	if (!x->oneshot)
+		workaroundCreepyXServer(x->dpy, dpms, x->idle[first]);
+	else {
+		/* the timeouts only matter if the monitor isn't on */
+		dpms->capable = DPMSQueryExtension(x->dpy, &dummy, &dummy) &&
+			DPMSInfo(x->dpy, &dpms->state, &dpms->onoff);
+		if (dpms->capable && dpms->onoff && dpms->state != DPMSModeOn)
+			DPMSGetTimeouts(x->dpy, &dpms->standby, &dpms->suspend, &dpms->off);
+	}
+	for (i = first; i < last; i++)
+		x->idle[i] = correctDPMSIdleTime(dpms, x->idle[i]);
+	*idle_ms = x->idle[DefaultScreen(x->dpy)];
+	/* Xlib waits for the reply of every request of a sample */
+	before = XNextRequest(x->dpy) - before;
+	x->requests += before;
+	x->roundtrips += before;
+	return 0;
+}
+#else
+/*!
+ * The sample of a handle from xidle_attach_oneshot(): the query
+ * extension requests of both extensions go out together, then the screen
+ * saver query and DPMSInfo, xidle_sample_recv() adds DPMSGetTimeouts if
+ * the monitor isn't on. Extensions are checked first because a request of
+ * a missing one would shut down the connection.
+ */
+static void sampleSendOneshot(struct xidle *x, xcb_connection_t *c) {
+	const xcb_query_extension_reply_t *ext;
+	int first, last, i;
+
+	if (!x->prefetched) {
+		xcb_prefetch_extension_data(c, &xcb_screensaver_id);
+		xcb_prefetch_extension_data(c, &xcb_dpms_id);
+		x->prefetched = true;
+		x->requests += 2;
+		x->roundtrips++;
+	}
+
+	x->sent = false;
+	ext = xcb_get_extension_data(c, &xcb_screensaver_id);
+	if (!ext || !ext->present)
+		return;
+	ext = xcb_get_extension_data(c, &xcb_dpms_id);
+	x->info = ext && ext->present;
+	x->timeouts = false;
+
+	screenRange(x, &first, &last);
+	for (i = first; i < last; i++)
+		x->ssc[i] = xcb_screensaver_query_info(c, RootWindow(x->dpy, i));
+	if (x->info)
+		x->infoc = xcb_dpms_info(c);
+	xcb_flush(c);
+	x->sent = true;
+	x->requests += last - first + x->info;
+	x->roundtrips++;
+}
+
+/*!
+ * XCB variant of the sampling. The screen saver query and the DPMS
+ * requests workaroundCreepyXServer() would issue one after another are
+ * all sent by xidle_sample_send() before xidle_sample_recv() waits for
+ * the first reply, so a sample costs a single round trip however many
+ * requests it needs. With xidle_all_screens(), the queries of all roots
+ * go out with the same flush.
+ */
+void xidle_sample_send(struct xidle *x) {
+	xcb_connection_t *c = XGetXCBConnection(x->dpy);
+	struct dpmsCache *dpms = &x->dpms;
+	struct timespec now;
+	int first, last, i;
+
+	if (x->oneshot) {
+		sampleSendOneshot(x, c);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	x->timeouts = dpms->capable &&
+		(dpms->stale || now.tv_sec - dpms->refreshed >= DPMS_REFRESH);
+	x->info = dpms->capable && (dpms->stale || !dpms->notify);
+
+	screenRange(x, &first, &last);
+	for (i = first; i < last; i++)
+		x->ssc[i] = xcb_screensaver_query_info(c, RootWindow(x->dpy, i));
+	if (x->info)
+		x->infoc = xcb_dpms_info(c);
+	if (x->timeouts)
+		x->timeoutsc = xcb_dpms_get_timeouts(c);
+	xcb_flush(c);
+	x->requests += last - first + x->info + x->timeouts;
+	x->roundtrips++;
+}
+
+int xidle_sample_recv(struct xidle *x, uint64_t *idle_ms) {
+	xcb_connection_t *c = XGetXCBConnection(x->dpy);
+	struct dpmsCache *dpms = &x->dpms;
+	xcb_screensaver_query_info_reply_t *ssr;
+	struct timespec now;
+	int first, last, i;
+	bool ok = true;
+
+	if (x->oneshot && !x->sent)
+		return -1;
+
+	screenRange(x, &first, &last);
+	for (i = first; i < last; i++) {
+		ssr = xcb_screensaver_query_info_reply(c, x->ssc[i], NULL);
+		if (ssr)
+			x->idle[i] = ssr->ms_since_user_input;
+		else
+			ok = false;
+		free(ssr);
+	}
+	if (x->info) {
+		xcb_dpms_info_reply_t *r = xcb_dpms_info_reply(c, x->infoc, NULL);
+		if (r) {
+			dpms->capable = dpms->capable || x->oneshot;
+			dpms->state = r->power_level;
+			dpms->onoff = r->state;
+			dpms->stale = false;
+			free(r);
+		}
+	}
+	if (x->oneshot && dpms->capable && dpms->onoff && dpms->state != DPMSModeOn) {
+		/* only now it's known that the timeouts are needed */
+		x->timeoutsc = xcb_dpms_get_timeouts(c);
+		x->timeouts = true;
+		x->requests++;
+		x->roundtrips++;
+	}
+	if (x->timeouts) {
+		xcb_dpms_get_timeouts_reply_t *r = xcb_dpms_get_timeouts_reply(c, x->timeoutsc, NULL);
+		if (r) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			dpms->standby = r->standby_timeout;
+			dpms->suspend = r->suspend_timeout;
+			dpms->off = r->off_timeout;
+			dpms->refreshed = now.tv_sec;
+			free(r);
+		}
+	}
+
+	if (!ok)
+		return -1;
+
+	for (i = first; i < last; i++)
+		x->idle[i] = correctDPMSIdleTime(dpms, x->idle[i]);
+	*idle_ms = x->idle[DefaultScreen(x->dpy)];
+	return 0;
+}
+#endif
+
+/*
+ * Idle time grows by exactly one millisecond per millisecond, so without
+ * the alarm the threshold can't be reached before threshold - idle ms.
+ */
+int xidle_wait(struct xidle *x, uint64_t threshold_ms, int timeout_ms) {
+	struct pollfd pfd = { .fd = ConnectionNumber(x->dpy), .events = POLLIN };
+	struct timespec start, now;
+	XSyncAlarm alarm;
+	uint64_t idle;
+	long left, wait;
+	int reached = 0;
+	XEvent ev;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (xidle_sample(x, &idle) < 0)
+		return -1;
+	if (idle >= threshold_ms)
+		return 1;
+
+	alarm = xidle_create_alarm(x, threshold_ms, XSyncPositiveComparison);
+	XFlush(x->dpy);
+
+	while (!reached) {
+		while (!reached && XPending(x->dpy)) {
+			XNextEvent(x->dpy, &ev);
+			if (!xidle_handle_event(x, &ev) && alarm != None &&
+			    xidle_alarm_event(x, &ev) == alarm)
+				reached = 1;
+		}
+		if (reached)
+			break;
+
+		left = -1;
+		if (timeout_ms >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 +
+			                     (now.tv_nsec - start.tv_nsec) / 1000000);
+			if (left <= 0)
+				break;
+		}
+		wait = left;
+		if (alarm == None) {
+			wait = threshold_ms - idle < INT_MAX ? (long) (threshold_ms - idle) : INT_MAX;
+			if (left >= 0 && wait > left)
+				wait = left;
+		}
+
+		if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+			reached = -1;
+			break;
+		}
+		if (alarm == None) {
+			if (xidle_sample(x, &idle) < 0)
+				reached = -1;
+			else if (idle >= threshold_ms)
+				reached = 1;
+		}
+	}
+
+	if (alarm != None) {
+		XSyncDestroyAlarm(x->dpy, alarm);
+		XFlush(x->dpy);
+	}
+	return reached;
+}
+
+uint64_t xidle_correct(struct xidle *x, uint64_t idle_ms) {
+	return workaroundCreepyXServer(x->dpy, &x->dpms, idle_ms);
+}
+
+uint16_t xidle_dpms_state(const struct xidle *x) {
+	if (!x->dpms.capable)
+		return XIDLE_DPMS_UNKNOWN;
+	return x->dpms.onoff ? x->dpms.state : DPMSModeOn;
+}
+
+int xidle_dpms_notify(const struct xidle *x) {
+	return x->dpms.notify;
+}
+
+void xidle_dpms_invalidate(struct xidle *x) {
+	x->dpms.stale = true;
+	x->dpms.refreshed = 0;
+}
+
+/*
+ * A DPMSInfoNotify event marks the cached DPMS state stale, it is re-read
+ * with the next sample.
+ */
+int xidle_handle_event(struct xidle *x, XEvent *ev) {
+	if (!x->dpms.notify || ev->type != GenericEvent ||
+	    ev->xgeneric.extension != x->dpms.opcode)
+		return 0;
+
+	x->dpms.stale = true;
+	return 1;
+}
+
+XSyncAlarm xidle_create_alarm(struct xidle *x, uint64_t value, XSyncTestType test) {
+	XSyncAlarmAttributes attr;
+
+	if (!findIdleCounter(x))
+		return None;
+
+	attr.trigger.counter = x->idleCounter;
+	attr.trigger.value_type = XSyncAbsolute;
+	attr.trigger.test_type = test;
+	XSyncIntsToValue(&attr.trigger.wait_value, value & 0xffffffff, value >> 32);
+	XSyncIntToValue(&attr.delta, 0);
+	attr.events = True;
+
+	return XSyncCreateAlarm(x->dpy, XSyncCACounter | XSyncCAValueType |
+	                        XSyncCATestType | XSyncCAValue | XSyncCADelta |
+	                        XSyncCAEvents, &attr);
+}
+
+XSyncAlarm xidle_alarm_event(const struct xidle *x, const XEvent *ev) {
+	if (x->idleCounter == None || ev->type != x->sync_event + XSyncAlarmNotify)
+		return None;
+	return ((const XSyncAlarmNotifyEvent *) ev)->alarm;
+}
+
+void xidle_counters(const struct xidle *x, unsigned long *requests, unsigned long *roundtrips) {
+	*requests = x->requests;
+	*roundtrips = x->roundtrips;
+}
+
+/*!
+ * Look up the IDLETIME system counter of the SYNC extension, which holds
+ * the server side idle time and can trigger alarms, and remember it in
+ * \a x.
+ *
+ * \return false if the SYNC extension or the counter is missing
+ */
+static bool findIdleCounter(struct xidle *x) {
+	XSyncSystemCounter *counters;
+	int sync_error, major, minor, ncounters, i;
+
+	if (x->idleCounter != None)
+		return true;
+
+	if (!XSyncQueryExtension(x->dpy, &x->sync_event, &sync_error) ||
+	    !XSyncInitialize(x->dpy, &major, &minor))
+		return false;
+
+	counters = XSyncListSystemCounters(x->dpy, &ncounters);
+	for (i = 0; counters && i < ncounters; i++)
+		if (!strcmp(counters[i].name, "IDLETIME"))
+			x->idleCounter = counters[i].counter;
+	if (counters)
+		XSyncFreeSystemCounterList(counters);
+
+	return x->idleCounter != None;
+}
+
+/*!
+ * One time probe of the DPMS extension, done at startup instead of on every
+ * sample. The timeouts are cached in \a dpms by the first sample and
+ * refreshed every DPMS_REFRESH seconds. If the server speaks DPMS 1.2,
+ * DPMSInfoNotify events are selected so the cached power level can be
+ * trusted until the server reports a change.
+ */
+#ifdef HAVE_DPMSSELECTINPUT
+static Bool dpmsWireToCookie(Display *dpy, XGenericEventCookie *cookie, xEvent *wire) {
+	xGenericEvent *ge = (xGenericEvent *) wire;
+
+	cookie->type = ge->type & 0x7f;
+	cookie->send_event = (ge->type & 0x80) != 0;
+	cookie->display = dpy;
+	cookie->extension = ge->extension;
+	cookie->evtype = ge->evtype;
+	return True;
+}
+#endif
+
+static void probeDPMS(Display *dpy, struct dpmsCache *dpms) {
+	int dummy;
+
+	memset(dpms, 0, sizeof(*dpms));
+	if (!DPMSQueryExtension(dpy, &dummy, &dummy) || !DPMSCapable(dpy))
+		return;
+
+	dpms->capable = true;
+	dpms->stale = true;
+	XQueryExtension(dpy, DPMSExtensionName, &dpms->opcode, &dummy, &dummy);
+
+#ifdef HAVE_DPMSSELECTINPUT
+	int major, minor;
+	if (DPMSGetVersion(dpy, &major, &minor) &&
+	    (major > 1 || (major == 1 && minor >= 2))) {
+		/* Xlib drops GenericEvents of extensions without a cookie handler */
+		XESetWireToEventCookie(dpy, dpms->opcode, dpmsWireToCookie);
+		DPMSSelectInput(dpy, DefaultRootWindow(dpy), DPMSInfoNotifyMask);
+		dpms->notify = true;
+	}
+#endif
+}
+
+/*!
+ * This function works around an XServer idleTime bug in the
+ * XScreenSaverExtension if dpms is running. In this case the current
+ * dpms-state time is always subtracted from the current idletime.
+ * This means: XScreenSaverInfo->idle is not the time since the last
+ * user activity, as descriped in the header file of the extension.
+ * This result in SUSE bug # and sf.net bug #. The bug in the XServer itself
+ * is reported at https://bugs.freedesktop.org/buglist.cgi?quicksearch=6439.
+ *
+ * Workaround: Check if if XServer is in a dpms state, check the
+ *             current timeout for this state and add this value to
+ *             the current idle time and return.
+ *
+ * The DPMS capability and timeouts come from \a dpms (see probeDPMS()),
+ * so usually at most the DPMSInfo round trip is left per call.
+ *
+ * \param _idleTime a unsigned long value with the current idletime from
+ *                  XScreenSaverInfo->idle
+ * \return a unsigned long with the corrected idletime
+ */
+static unsigned long workaroundCreepyXServer(Display *dpy, struct dpmsCache *dpms, unsigned long _idleTime ){
+	struct timespec now;
+
+	if (!dpms->capable)
+		return _idleTime;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (dpms->stale || now.tv_sec - dpms->refreshed >= DPMS_REFRESH) {
+		DPMSGetTimeouts(dpy, &dpms->standby, &dpms->suspend, &dpms->off);
+		dpms->refreshed = now.tv_sec;
+	}
+	if (dpms->stale || !dpms->notify) {
+		DPMSInfo(dpy, &dpms->state, &dpms->onoff);
+		dpms->stale = false;
+	}
+
+	return correctDPMSIdleTime(dpms, _idleTime);
+}
+
+/*!
+ * The DPMS correction of workaroundCreepyXServer() on its own, applied to
+ * the cached power level and timeouts without talking to the server.
+ */
+static unsigned long correctDPMSIdleTime(const struct dpmsCache *dpms, unsigned long _idleTime) {
+	CARD16 standby = dpms->standby;
+	CARD16 suspend = dpms->suspend;
+	CARD16 off = dpms->off;
+
+	if (dpms->capable && dpms->onoff) {
+		switch (dpms->state) {
+			case DPMSModeStandby:
+				/* this check is a littlebit paranoid, but be sure */
+				if (_idleTime < (unsigned) (standby * 1000))
+					_idleTime += (standby * 1000);
+				break;
+			case DPMSModeSuspend:
+				if (_idleTime < (unsigned) ((suspend + standby) * 1000))
+					_idleTime += ((suspend + standby) * 1000);
+				break;
+			case DPMSModeOff:
+				if (_idleTime < (unsigned) ((off + suspend + standby) * 1000))
+					_idleTime += ((off + suspend + standby) * 1000);
+				break;
+			case DPMSModeOn:
+			default:
+				break;
+		}
+	}
+
+	return _idleTime;
+}
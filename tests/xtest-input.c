@@ -0,0 +1,61 @@
+/*
+
+tests/xtest-input.c, the fake input of tests/xvfb-bench.sh: moves the
+pointer of $DISPLAY there and back through XTest, so the idle time of the
+server starts over, and with --dpms turns DPMS on first.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/dpms.h>
+
+/* the exit status of make check for a test that can't run here */
+#define SKIPPED 77
+
+int main(int argc, char *argv[]) {
+	Display *dpy;
+	int dummy;
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "--dpms"))) {
+		fprintf(stderr, "Usage: %s [--dpms]\n", argv[0]);
+		return 1;
+	}
+	dpy = XOpenDisplay(NULL);
+	if (!dpy) {
+		fprintf(stderr, "couldn't open display %s\n", XDisplayName(NULL));
+		return 1;
+	}
+	if (!XTestQueryExtension(dpy, &dummy, &dummy, &dummy, &dummy)) {
+		fprintf(stderr, "%s doesn't have XTest\n", XDisplayName(NULL));
+		return SKIPPED;
+	}
+
+	if (argc == 2) {
+		if (!DPMSQueryExtension(dpy, &dummy, &dummy) || !DPMSCapable(dpy)) {
+			fprintf(stderr, "%s doesn't have DPMS\n", XDisplayName(NULL));
+			return SKIPPED;
+		}
+		DPMSEnable(dpy);
+	}
+
+	XTestFakeRelativeMotionEvent(dpy, 1, 1, CurrentTime);
+	XTestFakeRelativeMotionEvent(dpy, -1, -1, CurrentTime);
+	/* the idle time has started over once the server has seen both */
+	XSync(dpy, False);
+	XCloseDisplay(dpy);
+	return 0;
+}
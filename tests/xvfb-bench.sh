@@ -0,0 +1,343 @@
+#!/bin/sh
+#
+# tests/xvfb-bench.sh, the suite of make check and make bench: runs
+# xidletool against an Xvfb with DPMS on, with the input faked through XTest
+# by tests/xtest-input, and prints one JSON object per line and measurement:
+#
+#   info       the version, the query path it was built with and the setup
+#   bench      the --bench -o json line of the build
+#   loop       round trips per sample, CPU ms per hour and wakeups per
+#              minute of a run waiting for thresholds, per mode and backend
+#   threshold  how many ms after the idle time reached a -t target the run
+#              ended, per mode and backend
+#   activity   the longest idle time printed while the input goes on every
+#              200 ms, per mode
+#   startup    ms of a whole -s, from the server and from a -D daemon
+#   reconnect  ms a --reconnect -p run took to reach its target after the
+#              server was restarted under it
+#
+# A mode or backend this build or machine doesn't have is reported with
+# "supported":false. The run fails if a polled sample costs more than
+# MAX_ROUND_TRIPS round trips on average (1.5, or 2.5 where the DPMS power
+# level has to be asked for with every sample), a target is noticed more than an
+# interval plus SLACK ms late, an idle time of an interval or more is
+# printed under constant input, a --reconnect run doesn't end once the
+# server is back or the plain loop doesn't work at all. It exits 77,
+# skipped, without Xvfb or XTest.
+#
+# Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of version 2 of the GNU General Public License
+# as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+XIDLETOOL=${XIDLETOOL:-./xidletool}
+XTEST_INPUT=${XTEST_INPUT:-tests/xtest-input}
+XVFB=${XVFB:-Xvfb}
+DURATION=${BENCH_SECONDS:-5}     # s of every loop run
+RUNS=${BENCH_RUNS:-3}            # threshold runs, ten times as many -s
+MAX_ROUND_TRIPS=${MAX_ROUND_TRIPS:-}  # by default from what --bench negotiated
+SLACK=${SLACK:-500}
+INTERVAL=1000
+TARGET=1500
+
+# the modes of the X loop, name and options
+MODES="poll|
+adaptive|-p
+alarm|-a
+verify|-x 60000
+raw|-X"
+
+# the push backends, which are tried with the plain loop only
+BACKENDS="evdev logind wayland"
+
+if ! command -v "$XVFB" >/dev/null 2>&1; then
+	echo "$XVFB not found, skipped" >&2
+	exit 77
+fi
+if ! test -x "$XTEST_INPUT"; then
+	echo "$XTEST_INPUT isn't built, it needs libXtst, skipped" >&2
+	exit 77
+fi
+
+tmp=$(mktemp -d) || exit 99
+xvfb=
+daemon=
+cleanup() {
+	test -n "$daemon" && kill "$daemon" 2>/dev/null
+	test -n "$xvfb" && kill "$xvfb" 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 99' INT TERM
+
+# start the server on display $1, without it -displayfd picks a free one
+# and writes its number
+startXvfb() {
+	rm -f "$tmp/display"
+	"$XVFB" $1 -displayfd 3 -screen 0 640x480x24 +extension DPMS -nolisten tcp \
+		3>"$tmp/display" >"$tmp/xvfb.log" 2>&1 &
+	xvfb=$!
+	i=0
+	while ! test -s "$tmp/display"; do
+		i=$((i + 1))
+		if test $i -gt 100 || ! kill -0 "$xvfb" 2>/dev/null; then
+			echo "$XVFB didn't start:" >&2
+			cat "$tmp/xvfb.log" >&2
+			exit 99
+		fi
+		sleep 0.1
+	done
+}
+
+startXvfb
+DISPLAY=:$(cat "$tmp/display")
+# no daemon of the user answers -s, no socket of the tests ends up there
+XDG_RUNTIME_DIR=$tmp
+export DISPLAY XDG_RUNTIME_DIR
+
+"$XTEST_INPUT" --dpms || exit $?
+
+if test -n "$BENCH_OUTPUT"; then
+	exec 4>"$BENCH_OUTPUT" || exit 99
+else
+	exec 4>&1
+fi
+
+failed=0
+
+emit() {
+	printf '%s\n' "$1" >&4
+}
+
+fail() {
+	echo "FAIL: $*" >&2
+	failed=1
+}
+
+nowNs() {
+	date +%s%N
+}
+
+# $1 / $2 with three decimals, null for nothing to divide by
+ratio() {
+	awk -v a="$1" -v b="$2" 'BEGIN { if (b == 0) print "null"; else printf "%.3f\n", a / b }'
+}
+
+# true if $1 > $2, as floats
+above() {
+	awk -v a="$1" -v b="$2" 'BEGIN { exit !(a > b) }'
+}
+
+# user and system CPU ms of process $1 so far
+cpuMs() {
+	awk -v hz="$(getconf CLK_TCK)" '{ printf "%d\n", ($14 + $15) * 1000 / hz }' "/proc/$1/stat"
+}
+
+unsupported() {
+	emit "{\"test\":\"$1\",\"mode\":\"$2\",\"backend\":\"$3\",\"supported\":false}"
+}
+
+# loop MODE BACKEND OPTIONS...: run until the thresholds, which are never
+# reached, for DURATION s and count what the run cost with SIGUSR1
+loop() {
+	mode=$1 backend=$2
+	shift 2
+	"$XIDLETOOL" -q -i $INTERVAL -t 3600000,7200000 "$@" >/dev/null 2>"$tmp/stats" &
+	pid=$!
+	sleep "$DURATION"
+	if ! kill -0 "$pid" 2>/dev/null; then
+		wait "$pid"
+		unsupported loop "$mode" "$backend"
+		return 1
+	fi
+	kill -USR1 "$pid"
+	sleep 0.2
+	cpu=$(cpuMs "$pid")
+	kill "$pid"
+	wait "$pid"
+
+	# samples: S | requests: R | round trips: T | wakeups: W | ...
+	set -- $(sed -n 's/^samples: \([0-9]*\) | requests: \([0-9]*\) | round trips: \([0-9]*\) | wakeups: \([0-9]*\) .*/\1 \2 \3 \4/p' "$tmp/stats" | tail -n 1)
+	if test $# -ne 4; then
+		fail "$mode/$backend: no statistics on SIGUSR1"
+		return 1
+	fi
+	perSample=$(ratio "$3" "$1")
+	# the wakeup for SIGUSR1 itself isn't the loop's
+	emit "{\"test\":\"loop\",\"mode\":\"$mode\",\"backend\":\"$backend\",\"seconds\":$DURATION,\"samples\":$1,\"requests\":$2,\"round_trips\":$3,\"round_trips_per_sample\":$perSample,\"cpu_ms_per_hour\":$(ratio $((cpu * 3600)) "$DURATION"),\"wakeups_per_minute\":$(ratio $((($4 - 1) * 60)) "$DURATION")}"
+	if test "$mode" = poll && test "$perSample" != null && above "$perSample" "$MAX_ROUND_TRIPS"; then
+		fail "$mode/$backend: $perSample round trips per sample, more than $MAX_ROUND_TRIPS"
+	fi
+	return 0
+}
+
+# threshold MODE BACKEND OPTIONS...: reset the idle time, wait for -t TARGET
+# and see how late the run ends, RUNS times
+threshold() {
+	mode=$1 backend=$2 total=0 max=0 n=0
+	shift 2
+	while test $n -lt "$RUNS"; do
+		"$XTEST_INPUT" || return 1
+		t0=$(nowNs)
+		if ! "$XIDLETOOL" -q -i $INTERVAL -t $TARGET "$@" >/dev/null 2>&1; then
+			unsupported threshold "$mode" "$backend"
+			return 1
+		fi
+		late=$((($(nowNs) - t0) / 1000000 - TARGET))
+		total=$((total + late))
+		test $late -gt $max && max=$late
+		n=$((n + 1))
+	done
+	emit "{\"test\":\"threshold\",\"mode\":\"$mode\",\"backend\":\"$backend\",\"target_ms\":$TARGET,\"runs\":$n,\"mean_ms\":$(ratio $total $n),\"max_ms\":$max}"
+	if test $max -gt $((INTERVAL + SLACK)); then
+		fail "$mode/$backend: target noticed $max ms late"
+	fi
+	return 0
+}
+
+# activity MODE BACKEND OPTIONS...: print the samples for DURATION s while
+# the input never pauses for long, none may reach an interval
+activity() {
+	mode=$1 backend=$2
+	shift 2
+	"$XTEST_INPUT" || return 1
+	"$XIDLETOOL" -i $INTERVAL "$@" >"$tmp/activity" 2>/dev/null &
+	pid=$!
+	end=$(($(nowNs) + DURATION * 1000000000))
+	while test "$(nowNs)" -lt $end; do
+		"$XTEST_INPUT" || break
+		sleep 0.2
+	done
+	if ! kill "$pid" 2>/dev/null; then
+		wait "$pid"
+		unsupported activity "$mode" "$backend"
+		return 1
+	fi
+	wait "$pid"
+	max=$(awk '$1 > max { max = $1 } END { print max + 0 }' "$tmp/activity")
+	emit "{\"test\":\"activity\",\"mode\":\"$mode\",\"backend\":\"$backend\",\"seconds\":$DURATION,\"samples\":$(wc -l <"$tmp/activity"),\"max_idle_ms\":$max}"
+	if test "$max" -ge $INTERVAL; then
+		fail "$mode/$backend: $max ms idle printed under constant input"
+	fi
+	return 0
+}
+
+# startup MODE BACKEND OPTIONS...: the wall time of a whole -s, RUNS * 10 times
+startup() {
+	mode=$1 backend=$2 total=0 min= max=0 n=0
+	shift 2
+	while test $n -lt $((RUNS * 10)); do
+		t0=$(nowNs)
+		if ! "$XIDLETOOL" -s "$@" >/dev/null 2>&1; then
+			unsupported startup "$mode" "$backend"
+			return 1
+		fi
+		t=$((($(nowNs) - t0) / 1000))
+		total=$((total + t))
+		test -z "$min" || test $t -lt "$min" && min=$t
+		test $t -gt $max && max=$t
+		n=$((n + 1))
+	done
+	emit "{\"test\":\"startup\",\"mode\":\"$mode\",\"backend\":\"$backend\",\"runs\":$n,\"mean_ms\":$(ratio $total $((n * 1000))),\"min_ms\":$(ratio "$min" 1000),\"max_ms\":$(ratio $max 1000)}"
+	return 0
+}
+
+# reconnect: wait for -t TARGET with --reconnect -p while the server is
+# down for longer than the target, the one shot timer fires without a
+# connection and the restarted server still has to be sampled
+reconnect() {
+	"$XTEST_INPUT" || return 1
+	"$XIDLETOOL" -q --reconnect -p -i $INTERVAL -t $TARGET >/dev/null 2>&1 &
+	pid=$!
+	sleep 0.5
+	if ! kill -0 "$pid" 2>/dev/null; then
+		wait "$pid"
+		unsupported reconnect adaptive "$build"
+		return 1
+	fi
+	kill "$xvfb"
+	wait "$xvfb"
+	sleep $(((TARGET + 999) / 1000))
+	startXvfb "$DISPLAY"
+	"$XTEST_INPUT" --dpms || exit $?
+	t0=$(nowNs)
+	# the retries are at most 1.6 s apart by then, allow twice that
+	i=0
+	while kill -0 "$pid" 2>/dev/null && test $i -lt $(((TARGET + INTERVAL + SLACK + 3200) / 100)); do
+		i=$((i + 1))
+		sleep 0.1
+	done
+	if kill "$pid" 2>/dev/null; then
+		wait "$pid"
+		fail "reconnect: the run didn't end after the server came back"
+		return 1
+	fi
+	if ! wait "$pid"; then
+		fail "reconnect: the run failed"
+		return 1
+	fi
+	emit "{\"test\":\"reconnect\",\"mode\":\"adaptive\",\"backend\":\"$build\",\"target_ms\":$TARGET,\"ms\":$((($(nowNs) - t0) / 1000000))}"
+	return 0
+}
+
+bench=$("$XIDLETOOL" --bench 100 -o json 2>"$tmp/bench")
+if test -z "$bench"; then
+	cat "$tmp/bench" >&2
+	fail "--bench didn't work"
+	exit 1
+fi
+# the X query path of the build, xlib or xcb
+build=$(printf '%s\n' "$bench" | sed -n '1s/.*"backend":"\([a-z]*\)".*/\1/p')
+version=$("$XIDLETOOL" -V | sed -n '1s/.* v\. //p')
+# without DPMSInfoNotify, libXext < 1.3.5 or DPMS < 1.2, a sample is two
+# round trips by design
+if test -z "$MAX_ROUND_TRIPS"; then
+	case $bench in
+	*'"dpms":true,"dpms_notify":false'*) MAX_ROUND_TRIPS=2.5 ;;
+	*) MAX_ROUND_TRIPS=1.5 ;;
+	esac
+fi
+emit "{\"test\":\"info\",\"version\":\"$version\",\"build\":\"$build\",\"max_round_trips\":$MAX_ROUND_TRIPS,\"seconds\":$DURATION,\"runs\":$RUNS,\"interval_ms\":$INTERVAL,\"timestamp\":$(date +%s)}"
+emit "{\"test\":\"bench\",\"backend\":\"$build\",\"result\":$(printf '%s\n' "$bench" | head -n 1)}"
+
+# the pipe runs the loop in a subshell, it hands failed back as its status
+printf '%s\n' "$MODES" | {
+	while IFS='|' read -r mode options; do
+		# the plain loop has to work, everything else may be missing
+		if ! loop "$mode" "$build" $options && test "$mode" = poll; then
+			fail "the plain loop didn't run"
+		fi
+		threshold "$mode" "$build" $options
+		activity "$mode" "$build" $options
+	done
+	exit $failed
+} || failed=1
+# -e has no target, it follows the screen saver
+loop events "$build" -e
+
+for backend in $BACKENDS; do
+	loop poll "$backend" -B "$backend"
+	# the idle time of evdev starts with the run, the others know their own
+	test "$backend" = evdev && threshold poll "$backend" -B "$backend"
+	test "$backend" = evdev || startup direct "$backend" -B "$backend"
+done
+
+startup direct "$build"
+"$XIDLETOOL" -D -q >/dev/null 2>&1 &
+daemon=$!
+i=0
+while ! test -S "$XDG_RUNTIME_DIR/xidletool.sock" && test $i -lt 50; do
+	i=$((i + 1))
+	sleep 0.1
+done
+startup daemon "$build"
+# last, the other runs need the server as it was
+reconnect
+
+exit $failed
@@ -0,0 +1,154 @@
+/*
+
+xidle.h, libxidle: the DPMS corrected user idle time of X displays, for
+use in-process instead of running xidletool.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef XIDLE_H
+#define XIDLE_H
+
+#include <stdint.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/sync.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* xidle_dpms_state() of a display without DPMS, as in xidletool-shm.h */
+#ifndef XIDLE_DPMS_UNKNOWN
+#define XIDLE_DPMS_UNKNOWN 0xffff
+#endif
+
+/*!
+ * A handle owns one display connection, the probed extensions and the
+ * DPMS cache that makes a sample cost a single round trip. Handles are not
+ * thread safe, use one per thread or lock around them.
+ */
+struct xidle;
+
+/*!
+ * Connect to \a display (NULL for $DISPLAY).
+ *
+ * \return the handle, NULL if the display can't be opened or has no
+ *         screen saver extension
+ */
+struct xidle *xidle_open(const char *display);
+
+/*!
+ * Like xidle_open() for a connection that is already open. The handle
+ * takes \a dpy over and closes it in xidle_close(), on failure \a dpy is
+ * left alone.
+ */
+struct xidle *xidle_attach(Display *dpy);
+
+/*!
+ * Like xidle_attach() for a handle that takes only one or a few samples,
+ * e.g. xidletool -s. There are no probes up front and nothing is cached:
+ * each sample asks for the DPMS state together with the screen saver info
+ * and for the DPMS timeouts only if the monitor isn't on.
+ */
+struct xidle *xidle_attach_oneshot(Display *dpy);
+
+/* close the connection and free \a x */
+void xidle_close(struct xidle *x);
+
+/* the connection of \a x, e.g. for its file descriptor */
+Display *xidle_display(struct xidle *x);
+
+/*!
+ * The DPMS corrected idle time of the default screen in \a idle_ms.
+ *
+ * \return 0, or -1 if the server couldn't be queried
+ */
+int xidle_sample(struct xidle *x, uint64_t *idle_ms);
+
+/*!
+ * xidle_sample() in two halves: send the requests of a sample, then wait
+ * for the replies. Sending on several handles before receiving on any of
+ * them overlaps their round trips when built with XCB, with Xlib all the
+ * work is done in xidle_sample_recv().
+ */
+void xidle_sample_send(struct xidle *x);
+int xidle_sample_recv(struct xidle *x, uint64_t *idle_ms);
+
+/*!
+ * Make every sample of \a x cover all screens of the connection instead
+ * of only the default one, one query per root window. The idle time
+ * xidle_sample() returns stays the default screen's.
+ */
+void xidle_all_screens(struct xidle *x);
+
+/* the DPMS corrected idle time of \a screen in the last sample */
+uint64_t xidle_screen_idle(const struct xidle *x, int screen);
+
+/*!
+ * Block until the display has been idle for \a threshold_ms, or for at
+ * most \a timeout_ms (-1 for no limit). Waits for an IDLETIME alarm if the
+ * server has the counter, polls as rarely as possible otherwise. Events
+ * that arrive on the connection meanwhile are dropped.
+ *
+ * \return 1 if the threshold was reached, 0 on timeout, -1 on errors
+ */
+int xidle_wait(struct xidle *x, uint64_t threshold_ms, int timeout_ms);
+
+/*!
+ * Apply the DPMS correction to \a idle_ms as reported by the screen saver
+ * extension, see xidle_sample(). May need a round trip if the cached DPMS
+ * state is stale.
+ */
+uint64_t xidle_correct(struct xidle *x, uint64_t idle_ms);
+
+/* the power level as a DPMSMode* value or XIDLE_DPMS_UNKNOWN */
+uint16_t xidle_dpms_state(const struct xidle *x);
+
+/*!
+ * 1 if the server reports changes of the power level, so a sample doesn't
+ * ask for it: DPMS 1.2 and a libXext that can select them. 0 otherwise,
+ * then every sample of a DPMS capable display costs a DPMSInfo more.
+ */
+int xidle_dpms_notify(const struct xidle *x);
+
+/* re-read the DPMS state and timeouts with the next sample */
+void xidle_dpms_invalidate(struct xidle *x);
+
+/*!
+ * Pass events of the connection of \a x that the caller reads itself
+ * through this, it keeps the DPMS cache up to date.
+ *
+ * \return 1 if the event was consumed
+ */
+int xidle_handle_event(struct xidle *x, XEvent *ev);
+
+/*!
+ * Create an alarm on the IDLETIME counter, triggering once at \a value ms
+ * with XSyncPositiveComparison or whenever input resets the idle time
+ * from above \a value with XSyncNegativeTransition.
+ *
+ * \return the alarm, None without the SYNC extension or IDLETIME counter
+ */
+XSyncAlarm xidle_create_alarm(struct xidle *x, uint64_t value, XSyncTestType test);
+
+/* the alarm \a ev is an AlarmNotify of, or None */
+XSyncAlarm xidle_alarm_event(const struct xidle *x, const XEvent *ev);
+
+/* requests sent and replies waited for by the samples of \a x so far */
+void xidle_counters(const struct xidle *x, unsigned long *requests, unsigned long *roundtrips);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,362 @@
+/*
+
+xidletool-backend.c, the loop of the push backends: sources of the idle
+time other than an X server, which report when the user goes idle or comes
+back instead of being polled, selected with -B.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <sys/timerfd.h>
+
+#include "xidletool.h"
+
+/* the backends built in, for -B */
+static const struct backend *backends[] = {
+#ifdef USE_WAYLAND
+	&waylandBackend,
+#endif
+#ifdef USE_LOGIND
+	&logindBackend,
+#endif
+#ifdef USE_EVDEV
+	&evdevBackend,
+#endif
+	NULL
+};
+
+/* the backend called \a name, NULL if there is none or it isn't built in */
+const struct backend *findBackend(const char *name) {
+	int i;
+
+	for (i = 0; backends[i]; i++)
+		if (!strcmp(backends[i]->name, name))
+			return backends[i];
+	return NULL;
+}
+
+/* the names of the backends built in, for usage() */
+const char *backendNames(void) {
+	static char names[128];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++)
+		len += snprintf(names + len, sizeof(names) - len, "%s%s",
+		                i ? ", " : "", backends[i]->name);
+	return len ? names : "none";
+}
+
+/*!
+ * The backend learned that \a d has been idle for \a idle ms at \a at,
+ * from then on its idle time simply grows with the clock.
+ */
+void backendIdle(struct display *d, unsigned long idle, const struct timespec *at) {
+	d->base = idle;
+	d->sampled = *at;
+	d->idle = true;
+}
+
+/*!
+ * Input on \a d at \a at. If its idle time was known, the idle period that
+ * ended is kept in d->current for -r. Until the next backendIdle() the
+ * idle time is below the resolution and reads 0.
+ */
+void backendActive(struct display *d, const struct timespec *at) {
+	if (d->idle) {
+		d->current = d->base + msSince(&d->sampled, at);
+		d->resumed = true;
+	}
+	d->idle = false;
+	d->base = 0;
+	d->sampled = *at;
+}
+
+/* the idle time of \a d at \a now as far as its backend knows */
+static void currentIdle(struct display *d, const struct timespec *now) {
+	d->current = d->idle ? d->base + msSince(&d->sampled, now) : 0;
+}
+
+/*!
+ * The first idle time a run acts on. A backend that is told the idle time
+ * at a timeout is asked for this one: with -q and a target or thresholds
+ * nothing happens before, otherwise the output has the resolution of the
+ * interval, as polling the X server would.
+ */
+static unsigned long firstIdle(const struct options *opts) {
+	unsigned long first = ULONG_MAX, interval = opts->interval / 1000;
+
+	if (opts->target > 0)
+		first = opts->target;
+	else if (opts->nthresholds > 0)
+		first = opts->thresholds[0];
+	if (opts->quiet && !opts->daemon && first != ULONG_MAX)
+		return first;
+	return first < interval ? first : interval;
+}
+
+/*!
+ * Run \a b with the -t, -r, -D and output options of the X loops. The
+ * poll() here waits on the backend, a periodic timer for the output lines
+ * and a one shot timer for the next threshold or target. The idle time is
+ * only learned from the backend, the timers are computed from it, so with
+ * -q nothing wakes up before something is due.
+ *
+ * \return the exit status for main()
+ */
+int runBackend(const struct backend *b, const struct options *opts, const char **names, int nnames) {
+	struct options o = *opts;
+	struct display *displays, *d;
+	struct pollfd pfds[7];
+	struct timespec now, deadline, flushed, never = { 0, 0 };
+	uint64_t expirations;
+	unsigned long remaining;
+	int n, i, pending, timeout, status = 1;
+	int ptfd = -1, dtfd = -1, gtfd = -1, mtfd = -1, lfd = -1;
+	bool tick = false;
+
+	n = b->open(opts, names, nnames, firstIdle(opts), &displays);
+	if (n < 0)
+		return 1;
+	for (i = 0; i < n; i++)
+		displays[i].id = i;
+	/* as with -W, entries that come and go are always named */
+	o.tag = n > 1 || b->entries;
+
+	if (opts->target == -1) {
+		if (!b->sample) {
+			fprintf(stderr, "the %s backend can't be asked for the idle time, "
+			        "-s needs a running -B %s -D daemon\n", b->name, b->name);
+			b->close();
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < n; i++) {
+			currentIdle(&displays[i], &now);
+			printIdle(&o, &displays[i]);
+		}
+		b->close();
+		return 0;
+	}
+
+	if (opts->daemon && (lfd = listenSocket(opts->socketPath)) < 0)
+		goto out;
+	ptfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	dtfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (ptfd < 0 || dtfd < 0) {
+		perror("timerfd_create");
+		goto out;
+	}
+	pfds[0].fd = ptfd;
+	pfds[1].fd = dtfd;
+	pfds[2].fd = b->fd();
+	pfds[3].fd = lfd;
+	pfds[4].fd = signalPipe[0];
+
+	clock_gettime(CLOCK_MONOTONIC, &flushed);
+	/* -g needs the ticks to see the idle periods, even with -q */
+	if (!opts->quiet || opts->aggregate) {
+		deadline = flushed;
+		timespecAddUs(&deadline, opts->interval);
+		armTimer(ptfd, &deadline, opts->interval);
+	}
+	if (opts->aggregate && opts->window) {
+		gtfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (gtfd < 0) {
+			perror("timerfd_create");
+			goto out;
+		}
+		deadline = flushed;
+		timespecAddUs(&deadline, opts->window * 1000);
+		armTimer(gtfd, &deadline, opts->window * 1000);
+	}
+	pfds[5].fd = gtfd;
+	if (opts->metricsPath && (mtfd = metricsTimer(opts)) < 0)
+		goto out;
+	pfds[6].fd = mtfd;
+	for (i = 0; i < 7; i++)
+		pfds[i].events = POLLIN;
+
+	/* with -r, the target is reached first if there is one */
+	pending = opts->target > 0 ? n : 0;
+	for (;;) {
+		/*
+		 * What the backend has read already, poll() wouldn't wake up
+		 * for. It is handled before the deadlines are computed from it.
+		 */
+		if (b->flush && !b->flush())
+			goto out;
+		if (b->entries) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			/* -g: the session is over, so is its window */
+			for (i = 0; i < n; i++)
+				if (displays[i].lost && opts->aggregate)
+					printSummary(&o, &displays[i], &now, false);
+			n = b->entries(&displays);
+			if (opts->target > 0)
+				for (pending = i = 0; i < n; i++)
+					pending += !displays[i].reached;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (opts->resume && pending == 0) {
+			for (i = 0; i < n && !displays[i].resumed; i++)
+				;
+			if (i < n) {
+				printResumed(&o, &displays[i]);
+				status = 0;
+				break;
+			}
+		}
+
+		remaining = ULONG_MAX;
+		for (i = 0; i < n; i++) {
+			d = &displays[i];
+			d->resumed = false;
+			currentIdle(d, &now);
+			/* waitResume() doesn't print samples either */
+			if (tick && !d->reached && !(opts->resume && pending == 0))
+				printIdle(&o, d);
+
+			if (opts->nthresholds > 0) {
+				/* resets are pushed, only crossings need the timer */
+				checkThresholds(&o, d, ULONG_MAX);
+				if (d->idle && d->crossed < opts->nthresholds &&
+				    opts->thresholds[d->crossed] - d->current < remaining)
+					remaining = opts->thresholds[d->crossed] - d->current;
+				continue;
+			}
+			if (opts->target <= 0 || d->reached)
+				continue;
+			if (d->current >= (unsigned long) opts->target) {
+				printReached(&o, d);
+				d->reached = true;
+				pending--;
+			} else if (d->idle && opts->target - d->current < remaining)
+				remaining = opts->target - d->current;
+		}
+		if (opts->target > 0 && pending == 0 && n > 0 && !opts->resume) {
+			status = 0;
+			break;
+		}
+
+		if (remaining != ULONG_MAX) {
+			deadline = now;
+			timespecAddUs(&deadline, remaining * 1000);
+			armTimer(dtfd, &deadline, 0);
+		} else
+			armTimer(dtfd, &never, 0);
+
+		/* -b as in runLoop() */
+		timeout = -1;
+		if (opts->flush && __fpending(stdout) > 0) {
+			if (msSince(&flushed, &now) >= opts->flush) {
+				fflush(stdout);
+				flushed = now;
+			} else
+				timeout = opts->flush - msSince(&flushed, &now);
+		}
+
+		if (poll(pfds, 7, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			goto out;
+		}
+		stats.wakeups++;
+
+		tick = false;
+		if (pfds[4].revents & POLLIN) {
+			unsigned char sig;
+
+			while (read(signalPipe[0], &sig, 1) == 1) {
+				if (sig == SIGUSR1) {
+					dumpStats();
+					if (opts->aggregate)
+						printSummaries(&o, displays, n, false);
+				} else if (sig == SIGCHLD)
+					reapHooks();
+				else if (sig == SIGUSR2)
+					tick = true;
+				else
+					terminated = true;
+			}
+			if (terminated) {
+				status = 0;
+				break;
+			}
+		}
+		if (pfds[2].revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "lost connection to the %s backend\n", b->name);
+			goto out;
+		}
+		if ((pfds[2].revents & POLLIN) && !b->dispatch())
+			goto out;
+		if (pfds[3].revents & POLLIN) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			for (i = 0; i < n; i++)
+				currentIdle(&displays[i], &now);
+			serveClient(lfd, displays, n, false);
+		}
+		if ((pfds[0].revents & POLLIN) &&
+		    read(ptfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+			stats.overruns += expirations - 1;
+			tick = true;
+		}
+		if ((pfds[5].revents & POLLIN) &&
+		    read(gtfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			printSummaries(&o, displays, n, true);
+		if ((pfds[6].revents & POLLIN) &&
+		    read(mtfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			for (i = 0; i < n; i++)
+				currentIdle(&displays[i], &now);
+			writeMetrics(&o, displays, n);
+		}
+		if ((pfds[1].revents & POLLIN) &&
+		    read(dtfd, &expirations, sizeof(expirations)) < 0) {
+			/* the deadline is checked above, however the loop woke up */
+		}
+	}
+
+out:
+	if (opts->aggregate && status == 0)
+		printSummaries(&o, displays, n, false);
+	if (ptfd >= 0)
+		close(ptfd);
+	if (dtfd >= 0)
+		close(dtfd);
+	if (gtfd >= 0)
+		close(gtfd);
+	if (mtfd >= 0) {
+		close(mtfd);
+		unlink(opts->metricsPath);
+	}
+	if (lfd >= 0) {
+		close(lfd);
+		unlink(opts->socketPath);
+	}
+	b->close();
+	return status;
+}
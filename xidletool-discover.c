@@ -0,0 +1,475 @@
+/*
+
+xidletool-discover.c, -W: the displays of a terminal server, found and
+dropped as their sockets come and go in /tmp/.X11-unix.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Every socket X<n> is opened as :n by a thread of its own, which hands the
+finished entry to runLoop() through a pipe, so a server that is slow to
+answer only delays itself. The cookie is the one in the -auth file of the
+server, found through its lock file, or in the user's Xauthority; to read
+other users' sessions the tool has to run as root.
+
+Xlib holds its global lock while it exchanges the connection setup, so
+before that a thread makes sure the server answers at all. The cookie
+Xlib sends is global too, a thread only waits for those opening with
+another one. The extension probes after it run in parallel.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <poll.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <X11/Xauth.h>
+
+#include "xidletool.h"
+
+#define X11_UNIX_DIR "/tmp/.X11-unix"
+
+/* a new socket may not be listened on yet, the first retry is after ms */
+#define OPEN_TRIES 5
+#define OPEN_RETRY 200
+
+/* ms a server has to answer the connection setup */
+#define SETUP_TIMEOUT 5000
+
+#define COOKIE_NAME "MIT-MAGIC-COOKIE-1"
+
+/* a display being opened, owned by its thread until it is on the pipe */
+struct pending {
+	int number;              /* of the socket, X<number> */
+	char name[16];           /* :number */
+	bool gone;               /* main thread only, the socket went away since */
+	bool ok;                 /* d is set up */
+	struct display d;
+	struct pending *next;
+};
+
+static int epfd = -1;
+static int ifd = -1;
+static int results[2] = { -1, -1 };   /* struct pending * from the threads */
+static struct pending *pendings;
+static char *userAuthority;           /* XauFileName(), before any thread runs */
+
+/* the -auth file on the command line of the server of display \a number */
+static char *serverAuthority(int number) {
+	char path[64], cmdline[4096], *arg;
+	long pid = 0;
+	ssize_t n;
+	FILE *f;
+	int fd;
+
+	snprintf(path, sizeof(path), "/tmp/.X%d-lock", number);
+	f = fopen(path, "re");
+	if (!f)
+		return NULL;
+	if (fscanf(f, "%ld", &pid) != 1 || pid <= 0) {
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	snprintf(path, sizeof(path), "/proc/%ld/cmdline", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	n = read(fd, cmdline, sizeof(cmdline) - 1);
+	close(fd);
+	if (n <= 0)
+		return NULL;
+	cmdline[n] = '\0';
+
+	for (arg = cmdline; arg + strlen(arg) + 1 < cmdline + n; arg += strlen(arg) + 1)
+		if (!strcmp(arg, "-auth"))
+			return strdup(arg + strlen(arg) + 1);
+	return NULL;
+}
+
+/* the MIT-MAGIC-COOKIE-1 for display \a number in \a file, or NULL */
+static Xauth *readCookie(const char *file, int number) {
+	char num[16];
+	Xauth *a;
+	FILE *f;
+	int len;
+
+	f = fopen(file, "re");
+	if (!f)
+		return NULL;
+	len = snprintf(num, sizeof(num), "%d", number);
+	while ((a = XauReadAuth(f))) {
+		if ((a->family == FamilyLocal || a->family == FamilyWild) &&
+		    (a->number_length == 0 ||
+		     (a->number_length == len && !memcmp(a->number, num, len))) &&
+		    a->name_length == strlen(COOKIE_NAME) &&
+		    !memcmp(a->name, COOKIE_NAME, a->name_length))
+			break;
+		XauDisposeAuth(a);
+	}
+	fclose(f);
+	return a;
+}
+
+/* the cookie of display \a number, its server's or else the user's */
+static Xauth *findCookie(int number) {
+	Xauth *a = NULL;
+	char *file;
+
+	if ((file = serverAuthority(number))) {
+		a = readCookie(file, number);
+		free(file);
+	}
+	if (!a && userAuthority)
+		a = readCookie(userAuthority, number);
+	return a;
+}
+
+/*!
+ * Send the connection setup with \a cookie to the socket of display
+ * \a number and wait SETUP_TIMEOUT ms for the first byte of the answer,
+ * whatever it is. A server that accepts but never answers would hold
+ * XOpenDisplay(), and Xlib's global lock with it, forever.
+ */
+static bool serverAnswers(int number, const Xauth *cookie) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	unsigned char setup[12 + 64 + 64], c;
+	uint16_t v[4] = { 11, 0, 0, 0 };
+	struct pollfd pfd;
+	size_t len = 12;
+	bool ok;
+	int fd;
+
+	memset(setup, 0, sizeof(setup));
+	setup[0] = __BYTE_ORDER == __LITTLE_ENDIAN ? 'l' : 'B';
+	if (cookie && cookie->name_length <= 64 && cookie->data_length <= 64) {
+		v[2] = cookie->name_length;
+		v[3] = cookie->data_length;
+		memcpy(setup + len, cookie->name, v[2]);
+		len += (v[2] + 3) & ~3;
+		memcpy(setup + len, cookie->data, v[3]);
+		len += (v[3] + 3) & ~3;
+	}
+	memcpy(setup + 2, v, sizeof(v));
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), X11_UNIX_DIR "/X%d", number);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	ok = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+		write(fd, setup, len) == (ssize_t) len &&
+		poll(&pfd, 1, SETUP_TIMEOUT) == 1 && read(fd, &c, 1) == 1;
+	close(fd);
+	return ok;
+}
+
+/* the cookie Xlib sends with XOpenDisplay(), shared by every open using it */
+static pthread_mutex_t authLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t authFree = PTHREAD_COND_INITIALIZER;
+static char *authName, *authData;   /* NULL before the first open */
+static int authNameLength, authDataLength;
+static int authUsers;               /* opens with it in progress */
+
+/* true if \a cookie, NULL for none, is what Xlib has been given */
+static bool authIs(const Xauth *cookie) {
+	int nl = cookie ? cookie->name_length : 0;
+	int dl = cookie ? cookie->data_length : 0;
+
+	return authName && nl == authNameLength && dl == authDataLength &&
+		(!nl || !memcmp(authName, cookie->name, nl)) &&
+		(!dl || !memcmp(authData, cookie->data, dl));
+}
+
+/* make \a cookie the one Xlib sends, authLock held and no open using another */
+static bool authSet(const Xauth *cookie) {
+	int nl = cookie ? cookie->name_length : 0;
+	int dl = cookie ? cookie->data_length : 0;
+	char *name = malloc(nl + 1), *data = malloc(dl + 1);
+
+	if (!name || !data) {
+		free(name);
+		free(data);
+		return false;
+	}
+	if (nl)
+		memcpy(name, cookie->name, nl);
+	if (dl)
+		memcpy(data, cookie->data, dl);
+	free(authName);
+	free(authData);
+	authName = name;
+	authData = data;
+	authNameLength = nl;
+	authDataLength = dl;
+	XSetAuthorization(authName, nl, authData, dl);
+	return true;
+}
+
+/*
+ * XOpenDisplay() \a name with \a cookie. Xlib has one cookie for all
+ * connections, so opens with the same cookie run side by side and one
+ * with another waits only until those are through.
+ */
+static Display *openWithCookie(const char *name, Xauth *cookie) {
+	Display *dpy;
+
+	pthread_mutex_lock(&authLock);
+	while (authUsers && !authIs(cookie))
+		pthread_cond_wait(&authFree, &authLock);
+	if (!authIs(cookie) && !authSet(cookie)) {
+		pthread_mutex_unlock(&authLock);
+		return NULL;
+	}
+	authUsers++;
+	pthread_mutex_unlock(&authLock);
+
+	dpy = XOpenDisplay(name);
+
+	pthread_mutex_lock(&authLock);
+	if (--authUsers == 0)
+		pthread_cond_broadcast(&authFree);
+	pthread_mutex_unlock(&authLock);
+	return dpy;
+}
+
+/* the thread of \a arg, a struct pending: connect, probe and hand it over */
+static void *openThread(void *arg) {
+	struct pending *p = arg;
+	unsigned long delay = OPEN_RETRY;
+	Display *dpy = NULL;
+	Xauth *cookie;
+	int try;
+
+	for (try = 0; try < OPEN_TRIES && !dpy; try++) {
+		if (try) {
+			usleep(delay * 1000);
+			delay *= 2;
+		}
+		cookie = findCookie(p->number);
+		if (serverAnswers(p->number, cookie))
+			dpy = openWithCookie(p->name, cookie);
+		if (cookie)
+			XauDisposeAuth(cookie);
+	}
+
+	if (!dpy)
+		fprintf(stderr, "couldn't open display %s\n", p->name);
+	else {
+#ifdef HAVE_XSETIOERROREXITHANDLER
+		XSetIOErrorExitHandler(dpy, displayLost, &p->d.lost);
+#endif
+		p->ok = attachDisplay(&p->d, dpy, false) && !p->d.lost;
+		if (!p->ok && p->d.x)
+			xidle_close(p->d.x);
+		else if (!p->ok)
+			XCloseDisplay(dpy);
+	}
+	if (write(results[1], &p, sizeof(p)) < 0) {
+		/* runLoop() has ended */
+	}
+	return NULL;
+}
+
+/* open display \a number in a thread, unless it is open or being opened */
+static void startOpen(int number) {
+	struct display *d;
+	struct pending *p;
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, saved;
+	char name[16];
+	int err;
+
+	snprintf(name, sizeof(name), ":%d", number);
+	if ((d = findDisplay(name)) && !d->lost)
+		return;
+	for (p = pendings; p; p = p->next)
+		if (p->number == number && !p->gone)
+			return;
+
+	p = calloc(1, sizeof(*p));
+	p->number = number;
+	strcpy(p->name, name);
+
+	/* the signals stay with the main thread and its pipe */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&thread, &attr, openThread, p);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (err) {
+		fprintf(stderr, "%s: pthread_create: %s\n", name, strerror(err));
+		free(p);
+		return;
+	}
+	p->next = pendings;
+	pendings = p;
+}
+
+/* display \a number lost its socket, drop it or what is being opened */
+static void socketGone(int number) {
+	struct display *d;
+	struct pending *p;
+	char name[16];
+
+	snprintf(name, sizeof(name), ":%d", number);
+	if ((d = findDisplay(name)))
+		d->lost = true;
+	for (p = pendings; p; p = p->next)
+		if (p->number == number)
+			p->gone = true;
+}
+
+/* the display number of the socket called \a name, -1 if it isn't one */
+static int socketNumber(const char *name) {
+	char *end;
+	long n;
+
+	if (name[0] != 'X' || name[1] < '0' || name[1] > '9')
+		return -1;
+	n = strtol(name + 1, &end, 10);
+	return *end || n > 65535 ? -1 : n;
+}
+
+/* open every display socket in X11_UNIX_DIR not open yet */
+static bool scanSockets(void) {
+	struct dirent *de;
+	DIR *dir;
+	int n;
+
+	dir = opendir(X11_UNIX_DIR);
+	if (!dir) {
+		perror(X11_UNIX_DIR);
+		return false;
+	}
+	while ((de = readdir(dir)))
+		if ((n = socketNumber(de->d_name)) >= 0)
+			startOpen(n);
+	closedir(dir);
+	return true;
+}
+
+/*!
+ * Watch X11_UNIX_DIR and open the displays it has. Those given with -d
+ * are in displays already and are left alone.
+ *
+ * \return the fd for runLoop() to poll, -1 with the reason printed
+ */
+int discoverStart(void) {
+	struct epoll_event ev;
+
+	userAuthority = XauFileName() ? strdup(XauFileName()) : NULL;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0 || pipe2(results, O_CLOEXEC) < 0) {
+		perror("discoverStart");
+		return -1;
+	}
+	fcntl(results[0], F_SETFL, O_NONBLOCK);
+
+	/* watch first, so no socket between the scan and the watch is lost */
+	ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd < 0 || inotify_add_watch(ifd, X11_UNIX_DIR, IN_CREATE | IN_DELETE |
+	                                 IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+		perror(X11_UNIX_DIR);
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = ifd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, ifd, &ev);
+	ev.data.fd = results[0];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, results[0], &ev);
+
+	if (!scanSockets())
+		return -1;
+	return epfd;
+}
+
+/* follow what inotify has reported on X11_UNIX_DIR */
+static void readSockets(void) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t n, off;
+	int number;
+
+	while ((n = read(ifd, buf, sizeof(buf))) > 0)
+		for (off = 0; off < n; off += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) (buf + off);
+			if (ev->mask & IN_Q_OVERFLOW) {
+				/* the sockets that are gone hang up on their own */
+				scanSockets();
+				continue;
+			}
+			if (!ev->len || (number = socketNumber(ev->name)) < 0)
+				continue;
+			if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+				startOpen(number);
+			else
+				socketGone(number);
+		}
+}
+
+/* take over the displays the threads have opened */
+static void readResults(const struct options *opts) {
+	struct pending *p, **link;
+
+	while (read(results[0], &p, sizeof(p)) == sizeof(p)) {
+		for (link = &pendings; *link != p; link = &(*link)->next)
+			;
+		*link = p->next;
+		if (p->ok && p->gone)
+			xidle_close(p->d.x);
+		else if (p->ok)
+			addDisplay(&p->d, opts);
+		free(p);
+	}
+}
+
+/* handle the socket changes and finished threads that are readable */
+void discoverDispatch(const struct options *opts) {
+	struct epoll_event evs[2];
+	int n, i;
+
+	n = epoll_wait(epfd, evs, 2, 0);
+	for (i = 0; i < n; i++) {
+		if (evs[i].data.fd == ifd)
+			readSockets();
+		else
+			readResults(opts);
+	}
+}
+
+/* stop watching, threads still connecting find the pipe closed */
+void discoverStop(void) {
+	close(ifd);
+	close(epfd);
+	close(results[0]);
+	ifd = epfd = results[0] = -1;
+	free(userAuthority);
+	userAuthority = NULL;
+}
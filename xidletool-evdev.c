@@ -0,0 +1,339 @@
+/*
+
+xidletool-evdev.c, the -B evdev backend: the idle time from the input
+devices themselves, read from /dev/input/event*.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Every key, button, motion and touch event moves the last input to its
+kernel timestamp, taken from CLOCK_MONOTONIC, so the idle time is exact and
+there is nothing to ask anyone. Devices plugged in later are picked up
+through inotify on the directory. The user needs read access to the
+devices, usually through the input group; they are never grabbed.
+
+Not everything there is the user. Accelerometers are left alone, and
+absolute axes only count on devices that also have a touch contact or
+pointer buttons: ambient light and the like, or a joystick at rest, send
+EV_ABS all the time and would keep the seat from ever going idle.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+
+#include "xidletool.h"
+
+#define EVDEV_DIR "/dev/input"
+
+/* events read per read(), a full report of most devices */
+#define EVDEV_BATCH 64
+
+/* the capability bitmaps of EVIOCGBIT and EVIOCGPROP */
+#define BITLONGS(n) ((n) / (8 * sizeof(long)) + 1)
+#define TESTBIT(bits, n) (((bits)[(n) / (8 * sizeof(long))] >> ((n) % (8 * sizeof(long)))) & 1)
+
+struct device {
+	int fd;
+	bool monotonic;          /* EVIOCSCLOCKID worked, the timestamps are ours */
+	bool absolute;           /* EV_ABS is the user, a touch screen, pad or pen */
+	char *path;
+	struct device *next;
+};
+
+static int epfd = -1;
+static int ifd = -1;              /* inotify on EVDEV_DIR, without -d */
+static struct device *devices;
+static struct display entry;      /* all devices feed one entry */
+static bool verbose;
+
+/* the device open on \a path, or NULL */
+static struct device *findDevice(const char *path) {
+	struct device *dev;
+
+	for (dev = devices; dev; dev = dev->next)
+		if (!strcmp(dev->path, path))
+			return dev;
+	return NULL;
+}
+
+/*!
+ * What of the device \a fd is the user: keys, buttons and relative motion
+ * always, absolute axes only next to a touch contact or pointer buttons.
+ * A file that isn't an input device, like a pipe given with -d, is taken
+ * as it is.
+ *
+ * \return false for a device the user doesn't work with, an accelerometer
+ *         or a sensor
+ */
+static bool userInput(int fd, bool *absolute) {
+	unsigned long types[BITLONGS(EV_MAX)] = { 0 };
+	unsigned long keys[BITLONGS(KEY_MAX)] = { 0 };
+	unsigned long props[BITLONGS(INPUT_PROP_MAX)] = { 0 };
+
+	*absolute = true;
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0)
+		return true;
+	ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+	/* older kernels have no properties, the bits stay clear */
+	ioctl(fd, EVIOCGPROP(sizeof(props)), props);
+	if (TESTBIT(props, INPUT_PROP_ACCELEROMETER))
+		return false;
+
+	*absolute = TESTBIT(types, EV_ABS) &&
+		(TESTBIT(keys, BTN_TOUCH) || TESTBIT(keys, BTN_LEFT) ||
+		 TESTBIT(keys, BTN_TOOL_PEN) || TESTBIT(keys, BTN_STYLUS));
+	return TESTBIT(types, EV_KEY) || TESTBIT(types, EV_REL) || *absolute;
+}
+
+/*!
+ * Start reading \a path. Devices that are already open are left alone,
+ * inotify reports a new node once for its creation and again when udev
+ * has set its permissions. One without input of the user is closed again.
+ *
+ * \return false with errno set if the device can't be read
+ */
+static bool openDevice(const char *path) {
+	struct epoll_event ev;
+	struct device *dev;
+	int fd, clock = CLOCK_MONOTONIC;
+	bool absolute;
+
+	if (findDevice(path))
+		return true;
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (!userInput(fd, &absolute)) {
+		if (verbose)
+			fprintf(stderr, "%s: not a device of the user, ignored\n", path);
+		close(fd);
+		return true;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	dev->fd = fd;
+	dev->absolute = absolute;
+	dev->path = strdup(path);
+	dev->monotonic = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+	ev.events = EPOLLIN;
+	ev.data.ptr = dev;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	dev->next = devices;
+	devices = dev;
+	if (verbose)
+		fprintf(stderr, "%s: reading input\n", path);
+	return true;
+}
+
+/* stop reading \a dev, it is gone */
+static void closeDevice(struct device *dev) {
+	struct device **p;
+
+	for (p = &devices; *p != dev; p = &(*p)->next)
+		;
+	*p = dev->next;
+	if (verbose)
+		fprintf(stderr, "%s: removed\n", dev->path);
+	close(dev->fd);
+	free(dev->path);
+	free(dev);
+}
+
+/* an event of \a type from \a dev is the user doing something */
+static bool isInput(const struct device *dev, unsigned type) {
+	return type == EV_KEY || type == EV_REL || (type == EV_ABS && dev->absolute);
+}
+
+/*!
+ * Read all events \a dev has queued. The first input of the batch ends
+ * the idle period, the last one is where the next one starts.
+ *
+ * \return false if the device went away
+ */
+static bool readDevice(struct device *dev) {
+	struct input_event evs[EVDEV_BATCH];
+	struct timespec first, last;
+	bool seen = false;
+	ssize_t n;
+	int i;
+
+	while ((n = read(dev->fd, evs, sizeof(evs))) > 0) {
+		for (i = 0; i < n / (ssize_t) sizeof(evs[0]); i++) {
+			if (!isInput(dev, evs[i].type))
+				continue;
+			if (dev->monotonic) {
+				last.tv_sec = evs[i].input_event_sec;
+				last.tv_nsec = evs[i].input_event_usec * 1000;
+			} else
+				clock_gettime(CLOCK_MONOTONIC, &last);
+			if (!seen)
+				first = last;
+			seen = true;
+		}
+	}
+	if (seen) {
+		backendActive(&entry, &first);
+		backendIdle(&entry, 0, &last);
+	}
+	/* end of file is a pipe given with -d that was closed, ENODEV an unplug */
+	return n < 0 && (errno == EAGAIN || errno == EINTR);
+}
+
+/* open the new event* nodes inotify has reported */
+static void readHotplug(void) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	char *path;
+	ssize_t n, off;
+
+	while ((n = read(ifd, buf, sizeof(buf))) > 0)
+		for (off = 0; off < n; off += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) (buf + off);
+			if (!ev->len || strncmp(ev->name, "event", 5))
+				continue;
+			if (asprintf(&path, EVDEV_DIR "/%s", ev->name) < 0)
+				continue;
+			openDevice(path);
+			free(path);
+		}
+}
+
+/*!
+ * Read the devices named with -d, or all of EVDEV_DIR and those added
+ * later. The idle time counts from now, what happened before can't be
+ * known.
+ *
+ * \return 1 for the one entry, -1 with the reason printed
+ */
+static int evdevOpen(const struct options *opts, const char **names, int nnames,
+                     unsigned long resolution, struct display **displays) {
+	struct epoll_event ev;
+	struct dirent *de;
+	struct timespec now;
+	char *path;
+	DIR *dir;
+	int i, denied = 0;
+
+	/* the kernel reports every event, nothing goes unnoticed */
+	(void) resolution;
+	verbose = opts->verbose;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	for (i = 0; i < nnames; i++)
+		if (!openDevice(names[i])) {
+			perror(names[i]);
+			return -1;
+		}
+
+	if (nnames == 0) {
+		/* watch first, so no device between the scan and the watch is lost */
+		ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ifd < 0 || inotify_add_watch(ifd, EVDEV_DIR, IN_CREATE | IN_ATTRIB) < 0) {
+			perror(EVDEV_DIR);
+			return -1;
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, ifd, &ev);
+
+		dir = opendir(EVDEV_DIR);
+		if (!dir) {
+			perror(EVDEV_DIR);
+			return -1;
+		}
+		while ((de = readdir(dir)))
+			if (!strncmp(de->d_name, "event", 5) &&
+			    asprintf(&path, EVDEV_DIR "/%s", de->d_name) >= 0) {
+				if (!openDevice(path) && errno == EACCES)
+					denied++;
+				free(path);
+			}
+		closedir(dir);
+	}
+	if (!devices) {
+		fprintf(stderr, "no input device %s can be read%s\n",
+		        nnames ? "given with -d" : "in " EVDEV_DIR,
+		        denied ? ", is the user in the input group?" : "");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	memset(&entry, 0, sizeof(entry));
+	entry.name = "input";
+	entry.owner = &entry;
+	entry.group = 1;
+	backendIdle(&entry, 0, &now);
+
+	*displays = &entry;
+	return 1;
+}
+
+static int evdevFd(void) {
+	return epfd;
+}
+
+/* handle every device and the hotplug watch that are readable */
+static bool evdevDispatch(void) {
+	struct epoll_event evs[16];
+	int n, i;
+
+	n = epoll_wait(epfd, evs, 16, 0);
+	for (i = 0; i < n; i++) {
+		if (!evs[i].data.ptr)
+			readHotplug();
+		else if ((evs[i].events & (EPOLLERR | EPOLLHUP)) || !readDevice(evs[i].data.ptr))
+			closeDevice(evs[i].data.ptr);
+	}
+	if (!devices && ifd < 0) {
+		fprintf(stderr, "all input devices are gone\n");
+		return false;
+	}
+	return true;
+}
+
+static void evdevClose(void) {
+	verbose = false;
+	while (devices)
+		closeDevice(devices);
+	if (ifd >= 0)
+		close(ifd);
+	if (epfd >= 0)
+		close(epfd);
+	ifd = epfd = -1;
+}
+
+const struct backend evdevBackend = {
+	.name = "evdev",
+	.seat = "input",
+	.sample = false,
+	.open = evdevOpen,
+	.fd = evdevFd,
+	.flush = NULL,
+	.dispatch = evdevDispatch,
+	.entries = NULL,
+	.close = evdevClose,
+};
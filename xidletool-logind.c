@@ -0,0 +1,505 @@
+/*
+
+xidletool-logind.c, the -B logind backend: the IdleHint of the sessions
+systemd-logind (or elogind) keeps, for hosts without an X server to ask.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+The session's desktop or logind itself sets IdleHint, IdleSinceHintMonotonic
+is when it changed last. Both are read once when the sessions are opened
+and then follow from PropertiesChanged, so a session is idle since the
+hint went up, and active below whatever timeout sets it. Sessions that
+log in later are added with SessionNew, those that log out are dropped
+with SessionRemoved, as -W does for X displays.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dbus/dbus.h>
+
+#include "xidletool.h"
+
+#define LOGIND_SERVICE   "org.freedesktop.login1"
+#define LOGIND_PATH      "/org/freedesktop/login1"
+#define LOGIND_MANAGER   "org.freedesktop.login1.Manager"
+#define LOGIND_SESSION   "org.freedesktop.login1.Session"
+
+/* one rule for the properties of every session */
+#define LOGIND_MATCH \
+	"type='signal',sender='" LOGIND_SERVICE "'," \
+	"interface='" DBUS_INTERFACE_PROPERTIES "',member='PropertiesChanged'," \
+	"path_namespace='" LOGIND_PATH "/session',arg0='" LOGIND_SESSION "'"
+
+/* and one for the sessions coming and going */
+#define LOGIND_SESSIONS_MATCH \
+	"type='signal',sender='" LOGIND_SERVICE "'," \
+	"interface='" LOGIND_MANAGER "',path='" LOGIND_PATH "'"
+
+/* timeout of the calls made while opening, in ms */
+#define LOGIND_TIMEOUT 5000
+
+struct session {
+	char *id;
+	char *path;
+};
+
+static bool handleMessages(void);
+
+static DBusConnection *bus;
+static struct display *entries;
+static struct session *sessions;
+static int nentries, size;
+static struct session *added;     /* SessionNew, not looked at yet */
+static int nadded;
+static const char **want;         /* -d */
+static int nwant;
+static int nextId;
+static bool verbose;
+
+/* \a usec of CLOCK_MONOTONIC as a timespec */
+static struct timespec usecTimespec(dbus_uint64_t usec) {
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	return ts;
+}
+
+/*!
+ * Pass IdleHint and IdleSinceHintMonotonic of the a{sv} at \a dict on to
+ * \a d. Changes that don't include IdleHint leave \a d alone.
+ */
+static void applyProperties(struct display *d, DBusMessageIter *dict) {
+	DBusMessageIter entry, variant;
+	struct timespec at;
+	const char *key;
+	dbus_bool_t hint = FALSE;
+	dbus_uint64_t since = 0;
+	bool haveHint = false;
+
+	for (; dbus_message_iter_get_arg_type(dict) == DBUS_TYPE_DICT_ENTRY;
+	     dbus_message_iter_next(dict)) {
+		dbus_message_iter_recurse(dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &variant);
+		if (!strcmp(key, "IdleHint") &&
+		    dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_BOOLEAN) {
+			dbus_message_iter_get_basic(&variant, &hint);
+			haveHint = true;
+		} else if (!strcmp(key, "IdleSinceHintMonotonic") &&
+		           dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_UINT64)
+			dbus_message_iter_get_basic(&variant, &since);
+	}
+	if (!haveHint)
+		return;
+
+	/* a hint that was never set has no time, it starts now */
+	if (since)
+		at = usecTimespec(since);
+	else
+		clock_gettime(CLOCK_MONOTONIC, &at);
+	if (hint)
+		backendIdle(d, 0, &at);
+	else
+		backendActive(d, &at);
+}
+
+/* the entry of the session at \a path, or NULL */
+static struct display *findSession(const char *path) {
+	int i;
+
+	for (i = 0; i < nentries; i++)
+		if (!strcmp(sessions[i].path, path))
+			return &entries[i];
+	return NULL;
+}
+
+/* -d has the session \a id or its \a seat, or there is no -d; \a found may be NULL */
+static bool wanted(const char *id, const char *seat, bool *found) {
+	bool match = false;
+	int i;
+
+	if (nwant == 0)
+		return *seat != '\0';
+	for (i = 0; i < nwant; i++)
+		if (!strcmp(want[i], id) || !strcmp(want[i], seat)) {
+			match = true;
+			if (found)
+				found[i] = true;
+		}
+	return match;
+}
+
+/* the seat id in the Seat (so) of the a{sv} at \a dict, "" for none */
+static const char *seatOf(DBusMessageIter dict) {
+	DBusMessageIter entry, variant, s;
+	const char *key, *seat = "";
+
+	for (; dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY;
+	     dbus_message_iter_next(&dict)) {
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &variant);
+		if (!strcmp(key, "Seat") &&
+		    dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_STRUCT) {
+			dbus_message_iter_recurse(&variant, &s);
+			dbus_message_iter_get_basic(&s, &seat);
+		}
+	}
+	return seat;
+}
+
+/* point the entries at their sessions again, entries or sessions have moved */
+static void pointEntries(void) {
+	int i;
+
+	for (i = 0; i < nentries; i++) {
+		entries[i].name = sessions[i].id;
+		entries[i].seat = &sessions[i];
+		entries[i].owner = &entries[i];
+	}
+}
+
+/* call \a method of \a interface on \a path, print the error on failure */
+static DBusMessage *callLogind(const char *path, const char *interface, const char *method,
+                               const char *arg) {
+	DBusMessage *msg, *reply;
+	DBusError err;
+
+	msg = dbus_message_new_method_call(LOGIND_SERVICE, path, interface, method);
+	if (arg)
+		dbus_message_append_args(msg, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
+	dbus_error_init(&err);
+	reply = dbus_connection_send_with_reply_and_block(bus, msg, LOGIND_TIMEOUT, &err);
+	dbus_message_unref(msg);
+	if (!reply) {
+		fprintf(stderr, "logind %s: %s\n", method, err.message);
+		dbus_error_free(&err);
+	}
+	return reply;
+}
+
+/* remember the session \a id at \a path for addSession() */
+static void queueSession(const char *id, const char *path) {
+	added = realloc(added, (nadded + 1) * sizeof(*added));
+	added[nadded].id = strdup(id);
+	added[nadded].path = strdup(path);
+	nadded++;
+}
+
+/* the session at \a path logged out, its entry is dropped with the next update */
+static void forgetSession(const char *path) {
+	struct display *d = findSession(path);
+	int i;
+
+	if (d)
+		d->lost = true;
+	for (i = 0; i < nadded; i++)
+		if (!strcmp(added[i].path, path)) {
+			free(added[i].id);
+			free(added[i].path);
+			added[i--] = added[--nadded];
+		}
+}
+
+/*!
+ * Read the properties of the session \a id at \a path and watch it from
+ * now on. With \a check only if -d wants it or it is on a seat, the seat
+ * is in the properties; ListSessions has told it for the others.
+ *
+ * \return false if logind couldn't be asked
+ */
+static bool addSession(const char *id, const char *path, bool check) {
+	DBusMessageIter iter, dict;
+	DBusMessage *reply;
+	struct display *d;
+
+	if (findSession(path))
+		return true;
+	reply = callLogind(path, DBUS_INTERFACE_PROPERTIES, "GetAll", LOGIND_SESSION);
+	if (!reply)
+		return false;
+	dbus_message_iter_init(reply, &iter);
+	dbus_message_iter_recurse(&iter, &dict);
+	if (check && !wanted(id, seatOf(dict), NULL)) {
+		dbus_message_unref(reply);
+		return true;
+	}
+
+	/* entries moves while it grows, pointEntries() catches up */
+	if (nentries == size) {
+		size = size ? 2 * size : 8;
+		entries = realloc(entries, size * sizeof(*entries));
+		sessions = realloc(sessions, size * sizeof(*sessions));
+	}
+	sessions[nentries].id = strdup(id);
+	sessions[nentries].path = strdup(path);
+	d = &entries[nentries++];
+	memset(d, 0, sizeof(*d));
+	d->id = nextId++;
+	d->group = 1;
+	pointEntries();
+	clock_gettime(CLOCK_MONOTONIC, &d->sampled);
+	applyProperties(d, &dict);
+	dbus_message_unref(reply);
+	if (verbose && check)
+		fprintf(stderr, "%s: watching\n", id);
+	return true;
+}
+
+/* drop the sessions that logged out, add those that logged in since */
+static void updateSessions(void) {
+	int i, n = 0;
+
+	for (i = 0; i < nentries; i++) {
+		if (!entries[i].lost) {
+			if (n != i) {
+				entries[n] = entries[i];
+				sessions[n] = sessions[i];
+			}
+			n++;
+			continue;
+		}
+		if (verbose)
+			fprintf(stderr, "%s: dropped\n", sessions[i].id);
+		free(sessions[i].id);
+		free(sessions[i].path);
+	}
+	nentries = n;
+	pointEntries();
+
+	/* one that is gone again before it is asked only costs a message */
+	for (i = 0; i < nadded; i++) {
+		addSession(added[i].id, added[i].path, true);
+		free(added[i].id);
+		free(added[i].path);
+	}
+	nadded = 0;
+}
+
+/*!
+ * Ask logind for its sessions, keep those on a seat, or those named by
+ * -d with their session id or seat, subscribe to their property changes
+ * and to new and removed sessions, and read the idle hints they have now.
+ * Without -d there may be no session yet, except for -s.
+ *
+ * \return the number of entries, -1 with the reason printed
+ */
+static int logindOpen(const struct options *opts, const char **names, int nnames,
+                      unsigned long resolution, struct display **displays) {
+	DBusMessageIter iter, array, s;
+	DBusMessage *reply;
+	DBusError err;
+	const char *id, *user, *seat, *path;
+	dbus_uint32_t uid;
+	bool *found;
+	int i;
+
+	/* the hint changes at logind's timeout, not at one of ours */
+	(void) resolution;
+	want = names;
+	nwant = nnames;
+	verbose = opts->verbose;
+	dbus_error_init(&err);
+	bus = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+	if (!bus) {
+		fprintf(stderr, "couldn't connect to the system bus: %s\n", err.message);
+		dbus_error_free(&err);
+		return -1;
+	}
+	dbus_connection_set_exit_on_disconnect(bus, FALSE);
+
+	/* before the sessions are listed, so no change in between is lost */
+	dbus_bus_add_match(bus, LOGIND_MATCH, &err);
+	if (!dbus_error_is_set(&err))
+		dbus_bus_add_match(bus, LOGIND_SESSIONS_MATCH, &err);
+	if (dbus_error_is_set(&err)) {
+		fprintf(stderr, "couldn't subscribe to logind: %s\n", err.message);
+		dbus_error_free(&err);
+		return -1;
+	}
+
+	reply = callLogind(LOGIND_PATH, LOGIND_MANAGER, "ListSessions", NULL);
+	if (!reply)
+		return -1;
+	found = calloc(nnames ? nnames : 1, sizeof(*found));
+	dbus_message_iter_init(reply, &iter);
+	dbus_message_iter_recurse(&iter, &array);
+	for (; dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT;
+	     dbus_message_iter_next(&array)) {
+		/* (susso): id, uid, user, seat, path */
+		dbus_message_iter_recurse(&array, &s);
+		dbus_message_iter_get_basic(&s, &id);
+		dbus_message_iter_next(&s);
+		dbus_message_iter_get_basic(&s, &uid);
+		dbus_message_iter_next(&s);
+		dbus_message_iter_get_basic(&s, &user);
+		dbus_message_iter_next(&s);
+		dbus_message_iter_get_basic(&s, &seat);
+		dbus_message_iter_next(&s);
+		dbus_message_iter_get_basic(&s, &path);
+		if (wanted(id, seat, found))
+			queueSession(id, path);
+	}
+	dbus_message_unref(reply);
+
+	for (i = 0; i < nnames; i++)
+		if (!found[i]) {
+			fprintf(stderr, "%s: no such session or seat\n", names[i]);
+			free(found);
+			return -1;
+		}
+	free(found);
+
+	for (i = 0; i < nadded; i++) {
+		if (!addSession(added[i].id, added[i].path, false))
+			return -1;
+		free(added[i].id);
+		free(added[i].path);
+	}
+	nadded = 0;
+
+	/* changes that came in while waiting for the replies are queued */
+	if (!handleMessages())
+		return -1;
+	updateSessions();
+	if (nentries == 0 && opts->target == -1) {
+		fprintf(stderr, "logind has no session on a seat\n");
+		return -1;
+	}
+
+	*displays = entries;
+	return nentries;
+}
+
+static int logindFd(void) {
+	int fd = -1;
+
+	dbus_connection_get_unix_fd(bus, &fd);
+	return fd;
+}
+
+/*!
+ * Handle the messages libdbus has read: the property changes of our
+ * sessions, sessions logging in or out and the disconnect. New sessions
+ * are only queued and lost ones marked, updateSessions() deals with them
+ * when entries may move.
+ *
+ * \return false if the bus went away
+ */
+static bool handleMessages(void) {
+	DBusMessageIter iter, dict;
+	DBusMessage *msg;
+	struct display *d;
+	const char *interface, *id, *path;
+	bool ok = true;
+
+	while ((msg = dbus_connection_pop_message(bus))) {
+		if (dbus_message_is_signal(msg, DBUS_INTERFACE_LOCAL, "Disconnected"))
+			ok = false;
+		else if (dbus_message_is_signal(msg, LOGIND_MANAGER, "SessionNew") &&
+		         dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &id,
+		                               DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID))
+			queueSession(id, path);
+		else if (dbus_message_is_signal(msg, LOGIND_MANAGER, "SessionRemoved") &&
+		         dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &id,
+		                               DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID))
+			forgetSession(path);
+		else if (dbus_message_is_signal(msg, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged") &&
+		         (d = findSession(dbus_message_get_path(msg))) &&
+		         dbus_message_iter_init(msg, &iter) &&
+		         dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_STRING) {
+			dbus_message_iter_get_basic(&iter, &interface);
+			dbus_message_iter_next(&iter);
+			if (!strcmp(interface, LOGIND_SESSION) &&
+			    dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
+				dbus_message_iter_recurse(&iter, &dict);
+				applyProperties(d, &dict);
+			}
+		}
+		dbus_message_unref(msg);
+	}
+	if (!ok)
+		fprintf(stderr, "lost connection to the system bus\n");
+	return ok;
+}
+
+/* the entries after flush(), with the sessions logged in or out since */
+static int logindEntries(struct display **displays) {
+	updateSessions();
+	*displays = entries;
+	return nentries;
+}
+
+/*
+ * Add the sessions dispatch() has queued. The replies addSession() waits
+ * for can bring signals along, libdbus queues them and the fd has nothing
+ * more to say, so they and the sessions they announce are handled until
+ * nothing is left.
+ */
+static bool logindFlush(void) {
+	updateSessions();
+	while (dbus_connection_get_dispatch_status(bus) == DBUS_DISPATCH_DATA_REMAINS) {
+		if (!handleMessages())
+			return false;
+		updateSessions();
+	}
+	return true;
+}
+
+/* read what the bus has sent, without blocking, and handle it */
+static bool logindDispatch(void) {
+	if (!dbus_connection_read_write(bus, 0)) {
+		fprintf(stderr, "lost connection to the system bus\n");
+		return false;
+	}
+	return handleMessages();
+}
+
+static void logindClose(void) {
+	int i;
+
+	for (i = 0; i < nentries; i++) {
+		free(sessions[i].id);
+		free(sessions[i].path);
+	}
+	for (i = 0; i < nadded; i++) {
+		free(added[i].id);
+		free(added[i].path);
+	}
+	free(sessions);
+	free(entries);
+	free(added);
+	sessions = added = NULL;
+	entries = NULL;
+	nentries = size = nadded = nextId = 0;
+	if (bus)
+		dbus_connection_unref(bus);
+}
+
+const struct backend logindBackend = {
+	.name = "logind",
+	.seat = NULL,
+	.sample = true,
+	.open = logindOpen,
+	.fd = logindFd,
+	.flush = logindFlush,
+	.dispatch = logindDispatch,
+	.entries = logindEntries,
+	.close = logindClose,
+};
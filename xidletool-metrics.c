@@ -0,0 +1,197 @@
+/*
+
+xidletool-metrics.c, --metrics: the idle times and counters of the run as
+a Prometheus text file, for the textfile collector of node_exporter.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+The file is rewritten once per interval from what the loop already knows,
+the same values -D serves, so a scrape never causes a round trip to the X
+server. It is written next to its name and renamed over it, a scrape
+sees either the old or the new one.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "xidletool.h"
+
+/* upper bounds of the sample latency buckets, in ns */
+static const uint64_t latencyBounds[LATENCY_BUCKETS] = {
+	100000, 250000, 500000, 1000000, 2500000, 5000000,
+	10000000, 25000000, 50000000, 100000000, 250000000, 1000000000,
+};
+
+/* count a sample that took \a ns in stats */
+void countLatency(uint64_t ns) {
+	int k;
+
+	for (k = 0; k < LATENCY_BUCKETS && ns > latencyBounds[k]; k++)
+		;
+	stats.latency[k]++;
+}
+
+/* \a name as a label value, " and \ escaped */
+static void printLabel(FILE *f, const char *name) {
+	for (; *name; name++) {
+		if (*name == '"' || *name == '\\')
+			fputc('\\', f);
+		if (*name == '\n')
+			fputs("\\n", f);
+		else
+			fputc(*name, f);
+	}
+}
+
+/* the HELP and TYPE lines of \a metric */
+static void printHeader(FILE *f, const char *metric, const char *type, const char *help) {
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", metric, help, metric, type);
+}
+
+/* one line of a per display \a metric */
+static void printDisplay(FILE *f, const char *metric, const struct display *d, long long value) {
+	fprintf(f, "%s{display=\"", metric);
+	printLabel(f, d->name);
+	fprintf(f, "\"} %lld\n", value);
+}
+
+/* the idle time of \a d as the loop knows it at \a now */
+static unsigned long cachedIdle(const struct options *opts, const struct display *d,
+                                const struct timespec *now) {
+	/* with -x the last sample is extrapolated, as -D does */
+	if (opts->verify && !opts->backend && d->x && extrapolates(d))
+		return d->base + msSince(&d->sampled, now);
+	return d->current;
+}
+
+static void printMetrics(FILE *f, const struct options *opts, const struct display *displays, int ndisplays) {
+	struct timespec now;
+	unsigned long requests, roundtrips;
+	uint64_t count = 0;
+	uint16_t dpms;
+	int i, k;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	printHeader(f, "xidle_idle_milliseconds", "gauge", "Time since the last input, from the last sample.");
+	for (i = 0; i < ndisplays; i++)
+		printDisplay(f, "xidle_idle_milliseconds", &displays[i], cachedIdle(opts, &displays[i], &now));
+
+	printHeader(f, "xidle_sample_age_milliseconds", "gauge", "Time since the idle time was last learned.");
+	for (i = 0; i < ndisplays; i++)
+		printDisplay(f, "xidle_sample_age_milliseconds", &displays[i], msSince(&displays[i].sampled, &now));
+
+	if (!opts->backend) {
+		printHeader(f, "xidle_dpms_state", "gauge",
+		            "DPMS state, 0 on, 1 standby, 2 suspend, 3 off, -1 unknown.");
+		for (i = 0; i < ndisplays; i++) {
+			dpms = displays[i].x ? xidle_dpms_state(displays[i].x) : XIDLE_DPMS_UNKNOWN;
+			printDisplay(f, "xidle_dpms_state", &displays[i], dpms < 4 ? dpms : -1);
+		}
+
+		printHeader(f, "xidle_connected", "gauge", "1 while the connection to the X server is up.");
+		for (i = 0; i < ndisplays; i++)
+			printDisplay(f, "xidle_connected", &displays[i], displays[i].x && !displays[i].lost);
+
+		/* the counters are per connection, -A entries share their owner's */
+		printHeader(f, "xidle_requests_total", "counter", "X requests sent for samples.");
+		for (i = 0; i < ndisplays; i++)
+			if (displays[i].x && !displays[i].shared) {
+				xidle_counters(displays[i].x, &requests, &roundtrips);
+				printDisplay(f, "xidle_requests_total", &displays[i], requests);
+			}
+		printHeader(f, "xidle_round_trips_total", "counter", "X round trips waited for by samples.");
+		for (i = 0; i < ndisplays; i++)
+			if (displays[i].x && !displays[i].shared) {
+				xidle_counters(displays[i].x, &requests, &roundtrips);
+				printDisplay(f, "xidle_round_trips_total", &displays[i], roundtrips);
+			}
+
+		printHeader(f, "xidle_sample_duration_seconds", "histogram", "Time a sample of the X server took.");
+		for (k = 0; k < LATENCY_BUCKETS; k++) {
+			count += stats.latency[k];
+			fprintf(f, "xidle_sample_duration_seconds_bucket{le=\"%g\"} %llu\n",
+			        latencyBounds[k] / 1e9, (unsigned long long) count);
+		}
+		fprintf(f, "xidle_sample_duration_seconds_bucket{le=\"+Inf\"} %lu\n"
+		        "xidle_sample_duration_seconds_sum %.9f\n"
+		        "xidle_sample_duration_seconds_count %lu\n",
+		        stats.samples, stats.queryTime / 1e9, stats.samples);
+	}
+
+	if (opts->nthresholds > 0) {
+		printHeader(f, "xidle_thresholds_crossed", "gauge", "Thresholds of -t crossed in the idle period.");
+		for (i = 0; i < ndisplays; i++)
+			printDisplay(f, "xidle_thresholds_crossed", &displays[i], displays[i].crossed);
+	}
+
+	printHeader(f, "xidle_wakeups_total", "counter", "Returns from poll() of the loop.");
+	fprintf(f, "xidle_wakeups_total %lu\n", stats.wakeups);
+	printHeader(f, "xidle_timer_overruns_total", "counter", "Timer expirations the loop missed.");
+	fprintf(f, "xidle_timer_overruns_total %lu\n", stats.overruns);
+}
+
+/*!
+ * Rewrite the --metrics file for \a displays. A failure is reported once,
+ * until a write works again.
+ */
+void writeMetrics(const struct options *opts, const struct display *displays, int ndisplays) {
+	static bool failing;
+	char *tmp;
+	FILE *f;
+	bool ok;
+
+	if (asprintf(&tmp, "%s.tmp", opts->metricsPath) < 0)
+		return;
+	f = fopen(tmp, "we");
+	ok = f != NULL;
+	if (f) {
+		printMetrics(f, opts, displays, ndisplays);
+		ok = fclose(f) == 0;
+	}
+	if (ok && rename(tmp, opts->metricsPath) < 0)
+		ok = false;
+	if (!ok) {
+		if (!failing)
+			perror(opts->metricsPath);
+		unlink(tmp);
+	}
+	failing = !ok;
+	free(tmp);
+}
+
+/*!
+ * The timer writeMetrics() is called on, once per interval from now on.
+ *
+ * \return a timerfd, or -1 with the reason printed
+ */
+int metricsTimer(const struct options *opts) {
+	struct timespec deadline;
+	int tfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespecAddUs(&deadline, opts->interval);
+	armTimer(tfd, &deadline, opts->interval);
+	return tfd;
+}
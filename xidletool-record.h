@@ -0,0 +1,47 @@
+/*
+
+xidletool-record.h, the records written by xidletool -o binary.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef XIDLETOOL_RECORD_H
+#define XIDLETOOL_RECORD_H
+
+#include <stdint.h>
+
+/* event */
+#define XIDLE_EVENT_SAMPLE    0   /* a sample, what the text output prints per interval */
+#define XIDLE_EVENT_REACHED   1   /* the -t target was reached */
+#define XIDLE_EVENT_CROSSED   2   /* threshold_ms of a -t list was crossed */
+#define XIDLE_EVENT_RESET     3   /* input reset the idle time below thresholds */
+#define XIDLE_EVENT_RESUME    4   /* -r, input ended an idle period of idle_ms */
+
+/*!
+ * One record per output line of the text format, always 40 bytes and all
+ * fields little endian, so a reader gets whole records with each read()
+ * of a multiple of the size. display is the position of the display in the
+ * -d list, with -A counting every screen, dpms_state as in xidletool-shm.h.
+ */
+struct xidle_record {
+	uint64_t monotonic_ns;   /* CLOCK_MONOTONIC the idle time refers to */
+	uint64_t wall_ns;        /* the same moment in CLOCK_REALTIME */
+	uint64_t idle_ms;
+	uint32_t threshold_ms;   /* XIDLE_EVENT_CROSSED and _REACHED only */
+	uint16_t dpms_state;
+	uint16_t display;
+	uint16_t event;
+	uint16_t reserved[3];
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+
+xidletool-shm.h, layout of the shared memory segment published by
+xidletool -M and a lock free reader for it.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef XIDLETOOL_SHM_H
+#define XIDLETOOL_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define XIDLE_SHM_MAGIC   0x31444958   /* "XID1" */
+#define XIDLE_SHM_NAMELEN 64
+
+/* dpms_state is a DPMSMode* value, or this if the display has no DPMS */
+#ifndef XIDLE_DPMS_UNKNOWN
+#define XIDLE_DPMS_UNKNOWN 0xffff
+#endif
+
+/* flags: readers extrapolate this sample, see xidle_shm_idle() */
+#define XIDLE_SHM_EXTRAPOLATE (1 << 0)
+
+/*!
+ * One record per monitored display. The writer makes sequence odd while
+ * it updates the record and even again when it is done (a seqlock), so a
+ * reader never needs a syscall or a lock to get a consistent snapshot.
+ */
+struct xidle_shm_record {
+	char display[XIDLE_SHM_NAMELEN];   /* constant after creation */
+	uint32_t sequence;
+	uint16_t dpms_state;
+	uint16_t flags;                    /* of the sample, may change with it */
+	uint64_t idle_ms;
+	uint64_t sample_monotonic_ns;      /* CLOCK_MONOTONIC of the sample */
+};
+
+struct xidle_shm {
+	uint32_t magic;
+	uint32_t count;
+	struct xidle_shm_record records[];
+};
+
+struct xidle_sample {
+	uint64_t idle_ms;
+	uint64_t sample_monotonic_ns;
+	uint16_t dpms_state;
+	uint16_t flags;
+	uint32_t sequence;
+};
+
+/*!
+ * Take a consistent snapshot of \a r. Spins while the writer is busy,
+ * which only ever takes a few stores.
+ */
+static inline void xidle_shm_read(const struct xidle_shm_record *r, struct xidle_sample *out)
+{
+	uint32_t start;
+
+	do {
+		while ((start = __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE)) & 1)
+			;
+		out->idle_ms = __atomic_load_n(&r->idle_ms, __ATOMIC_RELAXED);
+		out->sample_monotonic_ns = __atomic_load_n(&r->sample_monotonic_ns, __ATOMIC_RELAXED);
+		out->dpms_state = __atomic_load_n(&r->dpms_state, __ATOMIC_RELAXED);
+		out->flags = __atomic_load_n(&r->flags, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&r->sequence, __ATOMIC_RELAXED) != start);
+
+	out->sequence = start;
+}
+
+/* the record of \a display, or NULL if it isn't published */
+static inline const struct xidle_shm_record *xidle_shm_find(const struct xidle_shm *shm, const char *display)
+{
+	uint32_t i;
+
+	if (shm->magic != XIDLE_SHM_MAGIC)
+		return NULL;
+	for (i = 0; i < shm->count; i++)
+		if (!strncmp(shm->records[i].display, display, XIDLE_SHM_NAMELEN))
+			return &shm->records[i];
+	return NULL;
+}
+
+/*!
+ * The idle time of a snapshot at \a now_ns (CLOCK_MONOTONIC). Samples with
+ * XIDLE_SHM_EXTRAPOLATE are only replaced on input or for verification, in
+ * between the idle time simply grows with the clock. Those without it are
+ * replaced every interval.
+ */
+static inline uint64_t xidle_shm_idle(const struct xidle_sample *s, uint64_t now_ns)
+{
+	if (!(s->flags & XIDLE_SHM_EXTRAPOLATE) || now_ns < s->sample_monotonic_ns)
+		return s->idle_ms;
+	return s->idle_ms + (now_ns - s->sample_monotonic_ns) / 1000000;
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*
+
+xidletool-summary.c, -g: the idle periods found in the samples, summed
+up into one line per display and window instead of a line per sample.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+An idle period ends where a sample is below the one before it. Pauses
+shorter than the interval can't be told from typing, so only periods of
+at least one interval count. The idle time of a window is what of those
+periods fell into it, the rest of the window is active time; a period is
+counted in the histogram and as the longest with its whole length once it
+ends.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "xidletool.h"
+
+/* the histogram bucket of a period of \a ms */
+static int bucketOf(unsigned long ms) {
+	unsigned long s = ms / 1000;
+	int k = 0;
+
+	while (s >= 2 && k < SUMMARY_BUCKETS - 1) {
+		s >>= 1;
+		k++;
+	}
+	return k;
+}
+
+/* the shortest idle period -g counts */
+static unsigned long shortest(const struct options *opts) {
+	return opts->interval / 1000;
+}
+
+/*!
+ * Follow the sample \a d has just taken: input in between ended the
+ * idle period the samples before it have grown.
+ */
+void summarizeSample(const struct options *opts, struct display *d) {
+	struct summary *s = &d->summary;
+
+	if (!s->seeded) {
+		/* the idle time before the run isn't the window's */
+		s->seeded = true;
+		clock_gettime(CLOCK_MONOTONIC, &s->started);
+		s->peak = s->counted = d->current;
+		return;
+	}
+	if (d->current + RESUME_SLACK < s->peak) {
+		if (s->peak >= shortest(opts)) {
+			s->periods++;
+			s->idle += s->peak - s->counted;
+			s->histogram[bucketOf(s->peak)]++;
+			if (s->peak > s->longest)
+				s->longest = s->peak;
+		}
+		s->counted = 0;
+	}
+	s->peak = d->current;
+}
+
+/*!
+ * Print the summary of \a d for the window up to \a now, the ongoing
+ * period counts as far as it got. With \a restart the next window begins.
+ */
+void printSummary(const struct options *opts, struct display *d, const struct timespec *now, bool restart) {
+	struct summary *s = &d->summary;
+	unsigned long window, idle, active, ongoing = 0;
+	int k;
+
+	if (s->peak >= shortest(opts) && s->peak > s->counted)
+		ongoing = s->peak - s->counted;
+	window = s->seeded ? msSince(&s->started, now) : 0;
+	/* the ongoing period is as of the last sample, that may reach back
+	 * into the window before */
+	idle = s->idle + ongoing < window ? s->idle + ongoing : window;
+	active = window - idle;
+
+	if (opts->format == FORMAT_JSON) {
+		printf("{\"display\":\"");
+		printJsonString(d->name);
+		printf("\",\"event\":\"summary\",\"window_ms\":%lu,"
+		       "\"periods\":%lu,\"idle_ms\":%lu,\"active_ms\":%lu,\"longest_ms\":%lu,"
+		       "\"histogram\":[",
+		       window, s->periods, idle, active, s->longest);
+		for (k = 0; k < SUMMARY_BUCKETS; k++)
+			printf("%s%lu", k ? "," : "", s->histogram[k]);
+		printf("]}\n");
+	} else {
+		if (opts->tag)
+			printf("%s ", d->name);
+		printf("Summary: window: %lu | idle periods: %lu | idle: %lu | active: %lu | "
+		       "longest: %lu | histogram:", window, s->periods, idle, active, s->longest);
+		for (k = 0; k < SUMMARY_BUCKETS; k++)
+			if (s->histogram[k])
+				printf(" %lus:%lu", k ? 1UL << k : 0, s->histogram[k]);
+		printf(" | timestamp: %lu\n", time(NULL));
+	}
+
+	if (restart) {
+		s->started = *now;
+		s->periods = s->idle = s->longest = 0;
+		memset(s->histogram, 0, sizeof(s->histogram));
+		s->counted += ongoing;
+	}
+}
+
+/* printSummary() for all of \a displays, at the end of a window, the run or for SIGUSR1 */
+void printSummaries(const struct options *opts, struct display *displays, int ndisplays, bool restart) {
+	struct timespec now;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < ndisplays; i++)
+		printSummary(opts, &displays[i], &now, restart);
+}
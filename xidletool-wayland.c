@@ -0,0 +1,292 @@
+/*
+
+xidletool-wayland.c, the -B wayland backend: the idle time of the seats of
+a Wayland compositor through ext-idle-notify-v1.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+The compositor can't be asked for the idle time, it only sends idled
+once a seat has had no input for the timeout of a notification and
+resumed with the next input. One notification per seat at the first idle
+time the run acts on tells runBackend() exactly when the idle time is
+known, from there on it grows with the clock until resumed.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wayland-client.h>
+
+#include "xidletool.h"
+#include "ext-idle-notify-v1-client-protocol.h"
+
+/* input idle notifications ignore idle inhibitors, like the X server does */
+#ifdef EXT_IDLE_NOTIFIER_V1_GET_INPUT_IDLE_NOTIFICATION_SINCE_VERSION
+#define NOTIFIER_VERSION 2
+#else
+#define NOTIFIER_VERSION 1
+#endif
+
+struct seat {
+	struct wl_seat *seat;
+	char *name;
+	struct ext_idle_notification_v1 *notification;
+	struct seat *next;
+};
+
+static bool waylandFlush(void);
+
+static struct wl_display *wl;
+static struct wl_registry *registry;
+static struct ext_idle_notifier_v1 *notifier;
+static uint32_t notifierVersion;
+static struct seat *seats;
+static struct display *entries;
+static unsigned long timeout;    /* ms of the notifications */
+
+static void seatCapabilities(void *data, struct wl_seat *seat, uint32_t caps) {
+	/* the notifications cover whatever input the seat has */
+	(void) data;
+	(void) seat;
+	(void) caps;
+}
+
+static void seatName(void *data, struct wl_seat *seat, const char *name) {
+	struct seat *s = data;
+
+	(void) seat;
+	free(s->name);
+	s->name = strdup(name);
+}
+
+static const struct wl_seat_listener seatListener = {
+	.capabilities = seatCapabilities,
+	.name = seatName,
+};
+
+static void registryGlobal(void *data, struct wl_registry *r, uint32_t name,
+                           const char *interface, uint32_t version) {
+	struct seat *s, **tail;
+
+	(void) data;
+	if (!strcmp(interface, ext_idle_notifier_v1_interface.name)) {
+		notifierVersion = version < NOTIFIER_VERSION ? version : NOTIFIER_VERSION;
+		notifier = wl_registry_bind(r, name, &ext_idle_notifier_v1_interface, notifierVersion);
+	} else if (!strcmp(interface, wl_seat_interface.name)) {
+		/* in the order the compositor announces them, for the ids */
+		for (tail = &seats; *tail; tail = &(*tail)->next)
+			;
+		s = *tail = calloc(1, sizeof(*s));
+		s->seat = wl_registry_bind(r, name, &wl_seat_interface, version < 2 ? version : 2);
+		wl_seat_add_listener(s->seat, &seatListener, s);
+	}
+}
+
+/* seats going away keep their last idle time, as a closed display would */
+static void registryRemove(void *data, struct wl_registry *r, uint32_t name) {
+	(void) data;
+	(void) r;
+	(void) name;
+}
+
+static const struct wl_registry_listener registryListener = {
+	.global = registryGlobal,
+	.global_remove = registryRemove,
+};
+
+static void notificationIdled(void *data, struct ext_idle_notification_v1 *n) {
+	struct timespec now;
+
+	(void) n;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	backendIdle(data, timeout, &now);
+}
+
+static void notificationResumed(void *data, struct ext_idle_notification_v1 *n) {
+	struct timespec now;
+
+	(void) n;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	backendActive(data, &now);
+}
+
+static const struct ext_idle_notification_v1_listener notificationListener = {
+	.idled = notificationIdled,
+	.resumed = notificationResumed,
+};
+
+/* \a name is one of the -d seats, or there is no -d */
+static bool wanted(const char *name, const char **names, int nnames) {
+	int i;
+
+	for (i = 0; i < nnames; i++)
+		if (!strcmp(names[i], name))
+			return true;
+	return nnames == 0;
+}
+
+/*!
+ * Connect to $WAYLAND_DISPLAY and ask for a notification at \a resolution
+ * ms on each seat, or on those named with -d.
+ *
+ * \return the number of entries, -1 with the reason printed
+ */
+static int waylandOpen(const struct options *opts, const char **names, int nnames,
+                       unsigned long resolution, struct display **displays) {
+	struct timespec now;
+	struct display *d;
+	struct seat *s;
+	int n = 0, i;
+
+	/* the output options are runBackend()'s */
+	(void) opts;
+	timeout = resolution ? resolution : 1;
+	wl = wl_display_connect(NULL);
+	if (!wl) {
+		fprintf(stderr, "couldn't connect to the wayland compositor %s\n",
+		        getenv("WAYLAND_DISPLAY") ? getenv("WAYLAND_DISPLAY") : "wayland-0");
+		return -1;
+	}
+	registry = wl_display_get_registry(wl);
+	wl_registry_add_listener(registry, &registryListener, NULL);
+
+	/* the globals first, then the names of the seats bound meanwhile */
+	if (wl_display_roundtrip(wl) < 0 || wl_display_roundtrip(wl) < 0) {
+		fprintf(stderr, "lost connection to the wayland compositor\n");
+		return -1;
+	}
+	if (!notifier) {
+		fprintf(stderr, "the compositor doesn't support ext-idle-notify-v1\n");
+		return -1;
+	}
+
+	for (s = seats, i = 0; s; s = s->next, i++)
+		if (!s->name && asprintf(&s->name, "seat%d", i) < 0)
+			return -1;
+	for (i = 0; i < nnames; i++) {
+		for (s = seats; s && strcmp(s->name, names[i]); s = s->next)
+			;
+		if (!s) {
+			fprintf(stderr, "%s: no such seat\n", names[i]);
+			return -1;
+		}
+	}
+
+	for (s = seats; s; s = s->next)
+		n++;
+	entries = calloc(n ? n : 1, sizeof(*entries));
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	n = 0;
+	for (s = seats; s; s = s->next) {
+		if (!wanted(s->name, names, nnames))
+			continue;
+		d = &entries[n++];
+		d->name = s->name;
+		d->seat = s;
+		d->owner = d;
+		d->group = 1;
+		d->sampled = now;
+#ifdef EXT_IDLE_NOTIFIER_V1_GET_INPUT_IDLE_NOTIFICATION_SINCE_VERSION
+		if (notifierVersion >= 2)
+			s->notification = ext_idle_notifier_v1_get_input_idle_notification(notifier, timeout, s->seat);
+		else
+#endif
+			s->notification = ext_idle_notifier_v1_get_idle_notification(notifier, timeout, s->seat);
+		ext_idle_notification_v1_add_listener(s->notification, &notificationListener, d);
+	}
+	if (n == 0) {
+		fprintf(stderr, "the wayland compositor has no seat\n");
+		return -1;
+	}
+	if (!waylandFlush())
+		return -1;
+
+	*displays = entries;
+	return n;
+}
+
+static int waylandFd(void) {
+	return wl_display_get_fd(wl);
+}
+
+/*!
+ * Handle the events libwayland has queued already, the roundtrips in
+ * waylandOpen() may have read some that poll() won't wake up for, and send
+ * the requests runBackend() made us queue, before it sleeps.
+ */
+static bool waylandFlush(void) {
+	if (wl_display_dispatch_pending(wl) < 0) {
+		fprintf(stderr, "lost connection to the wayland compositor\n");
+		return false;
+	}
+	if (wl_display_flush(wl) < 0 && errno != EAGAIN) {
+		perror("wl_display_flush");
+		return false;
+	}
+	return true;
+}
+
+/*!
+ * Read what poll() found on the socket and handle it. wl_display_dispatch()
+ * would poll the socket again and block when the events poll() woke up for
+ * were read already, this only reads what is there.
+ */
+static bool waylandDispatch(void) {
+	while (wl_display_prepare_read(wl) != 0)
+		if (wl_display_dispatch_pending(wl) < 0)
+			goto lost;
+	if (wl_display_read_events(wl) < 0 && errno != EAGAIN)
+		goto lost;
+	if (wl_display_dispatch_pending(wl) < 0)
+		goto lost;
+	return true;
+
+lost:
+	fprintf(stderr, "lost connection to the wayland compositor\n");
+	return false;
+}
+
+static void waylandClose(void) {
+	struct seat *s, *next;
+
+	for (s = seats; s; s = next) {
+		next = s->next;
+		if (s->notification)
+			ext_idle_notification_v1_destroy(s->notification);
+		wl_seat_destroy(s->seat);
+		free(s->name);
+		free(s);
+	}
+	seats = NULL;
+	if (notifier)
+		ext_idle_notifier_v1_destroy(notifier);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(wl);
+	free(entries);
+}
+
+const struct backend waylandBackend = {
+	.name = "wayland",
+	.seat = "seat0",
+	.sample = false,
+	.open = waylandOpen,
+	.fd = waylandFd,
+	.flush = waylandFlush,
+	.dispatch = waylandDispatch,
+	.entries = NULL,
+	.close = waylandClose,
+};
@@ -28,67 +28,246 @@ along with this program; if not, write to the
 Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
-The function workaroundCreepyXServer was adapted from kpowersave-0.7.3 by
-Eivind Magnus Hvidevold <hvidevold@gmail.com>. kpowersave is licensed under
-the GNU GPL, version 2 _only_.
+The sampling itself lives in libxidle, see libxidle.c.
 
 */
 
 #define VERSION "0.3"
 
+/* ms between the sanity samples of -X without -x */
+#define RAW_VERIFY 60000
+
+/* ms --reconnect waits for a lost display, doubled after every failure */
+#define RECONNECT_FIRST 100
+#define RECONNECT_MAX 30000
+
+#define _GNU_SOURCE
+
 #include <X11/Xlib.h>
+#include <X11/XKBlib.h>
 #include <X11/extensions/dpms.h>
 #include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
+#ifdef USE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <signal.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <stdio_ext.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+
+#include "xidle.h"
+#include "xidletool-shm.h"
+#include "xidletool-record.h"
+#include "xidletool.h"
 
-void usage(char *name);
-void thisVersion(char *name);
-unsigned long workaroundCreepyXServer(Display *dpy, unsigned long _idleTime );
-static void signal_callback_handler(int sig, siginfo_t *siginfo, void *context);
+#ifdef USE_XCB
+#define USE_XCB_NAME "xcb"
+#define QUERY_NAME "pipelined sample"
+#else
+#define USE_XCB_NAME "xlib"
+#define QUERY_NAME "XScreenSaverQueryInfo"
+#endif
 
-Display *dpy;
+static void signalToPipe(int sig);
+static int ioError(Display *dpy);
+static void sampleWaiting(struct display *displays, int ndisplays);
+
+static struct display *allDisplays;  /* the -d displays, their screens and -W's */
+static int nAllDisplays;
+static int nextId;         /* -W: the id of the next display added */
+static bool displaysChanged;   /* -W: entries were added or dropped */
+static bool sampleSoon;        /* -p: an entry was added or reconnected, sample it */
+static uint16_t shmFlags;      /* -M: the flags of createShm() */
+struct stats stats;
+
+/* signals are handled in the main loop, the handler only writes here */
+int signalPipe[2] = { -1, -1 };
+bool terminated;           /* the loop was left for SIGTERM or SIGINT */
 
 int main(int argc, char *argv[])
 {
-	XScreenSaverInfo ssi;
-//	Display *dpy;
-	int event_basep, error_basep;
+	const char **names = NULL;
+	int nnames = 0, i, status;
+	const char *onIdle = NULL, *onResume = NULL;
+	bool shell = false, oneshot;
 
-	bool verbose = false;
-	bool quiet = false;
-	long target = 0;
-	unsigned long interval = 1000000;
+	struct options opts = {
+		.interval = 1000000,
+	};
+
+	/* long options without a short one use values above any character */
+	enum { OPT_BENCH = 256, OPT_ON_IDLE, OPT_ON_RESUME, OPT_SHELL, OPT_RECONNECT, OPT_METRICS };
+	static const struct option longopts[] = {
+		{ "bench", required_argument, NULL, OPT_BENCH },
+		{ "on-idle", required_argument, NULL, OPT_ON_IDLE },
+		{ "on-resume", required_argument, NULL, OPT_ON_RESUME },
+		{ "shell", no_argument, NULL, OPT_SHELL },
+		{ "reconnect", no_argument, NULL, OPT_RECONNECT },
+		{ "metrics", required_argument, NULL, OPT_METRICS },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	int c = 0;
-	while ((c = getopt (argc, argv, "svVqt:i:")) != -1)
+	while ((c = getopt_long (argc, argv, "seapRrADMXWvVqt:i:d:S:x:c:b:o:B:g:", longopts, NULL)) != -1)
 		switch (c)
 			{
+			case OPT_BENCH: //measure the cost of N samples
+				opts.bench = atoi(optarg);
+				if (opts.bench <= 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case OPT_ON_IDLE: //run a command when a threshold is crossed
+				onIdle = optarg;
+				break;
+			case OPT_ON_RESUME: //run a command when input resets the idle time
+				onResume = optarg;
+				break;
+			case OPT_SHELL: //run the hooks with /bin/sh -c
+				shell = true;
+				break;
+			case OPT_RECONNECT: //open a display again when its server went away
+#ifdef HAVE_XSETIOERROREXITHANDLER
+				opts.reconnect = true;
+				break;
+#else
+				fprintf(stderr, "--reconnect needs libX11 1.7 or later.\n");
+				return 1;
+#endif
+			case OPT_METRICS: //rewrite a Prometheus text file every interval
+				opts.metricsPath = optarg;
+				break;
 			case 's': //just print idleTime
-				target = -1;
+				opts.target = -1;
+				break;
+			case 'e': //wait for screen saver events instead of polling
+				opts.events = true;
+				break;
+			case 'a': //wait for the target with an XSync alarm
+				opts.alarm = true;
+				break;
+			case 'p': //predict when the target can be reached
+				opts.adaptive = true;
 				break;
 			case 'v': //verbose
-				verbose = true;
+				opts.verbose = true;
 				break;
 			case 'q': //be quiet (only useful if -t specified)
-				quiet = true;
+				opts.quiet = true;
+				break;
+			case 't': //timeout, or a comma separated list of thresholds
+				opts.nthresholds = parseThresholds(optarg, &opts.thresholds);
+				if (opts.nthresholds == 1) {
+					opts.target = opts.thresholds[0];
+					opts.nthresholds = 0;
+				} else
+					opts.target = opts.nthresholds > 1 ? 0 : -2;
+				break;
+			case 'R': //report resets of the idle time below thresholds
+				opts.resets = true;
 				break;
-			case 't': //timeout
-				target = atoi(optarg);
+			case 'r': //wait for the user to come back
+				opts.resume = true;
+				break;
+			case 'A': //every screen of the displays
+				opts.screens = true;
 				break;
 			case 'i':
-				interval = atoi(optarg) * 1000;
+				opts.interval = atoi(optarg) * 1000;
+				break;
+			case 'd': //display, may be given more than once
+				names = realloc(names, (nnames + 1) * sizeof(*names));
+				names[nnames++] = optarg;
+				break;
+			case 'D': //serve the idle time to -s clients
+				opts.daemon = true;
+				break;
+			case 'S': //socket of -D and -s
+				opts.socketPath = optarg;
+				break;
+			case 'M': //publish samples in shared memory
+				opts.publish = true;
+				break;
+			case 'x': //extrapolate, verify with the server every x ms
+				opts.verify = atoi(optarg);
+				break;
+			case 'X': //notice input through XInput2 raw events
+#ifdef USE_XINPUT2
+				opts.rawInput = true;
+				break;
+#else
+				fprintf(stderr, "-X needs XInput2, this build doesn't have it.\n");
+				return 1;
+#endif
+			case 'W': //open the displays of /tmp/.X11-unix as they come and go
+#ifdef USE_DISCOVER
+				opts.discover = true;
+				break;
+#else
+				fprintf(stderr, "-W needs inotify and libXau, this build doesn't have it.\n");
+				return 1;
+#endif
+			case 'g': //summaries of the idle periods, every g ms
+				opts.aggregate = true;
+				opts.window = atoi(optarg);
+				break;
+			case 'c': //only print changes, in buckets of c ms
+				opts.bucket = atoi(optarg);
+				break;
+			case 'b': //block buffered output, flushed every b ms
+				opts.flush = atoi(optarg);
+				break;
+			case 'o': //output format
+				if (!strcmp(optarg, "text"))
+					opts.format = FORMAT_TEXT;
+				else if (!strcmp(optarg, "binary"))
+					opts.format = FORMAT_BINARY;
+				else if (!strcmp(optarg, "json"))
+					opts.format = FORMAT_JSON;
+				else {
+					fprintf(stderr, "Unknown output format `%s'.\n", optarg);
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'B': //where the idle time comes from
+				if (!strcmp(optarg, "x11"))
+					opts.backend = NULL;
+				else if (!(opts.backend = findBackend(optarg))) {
+					fprintf(stderr, "Unknown backend `%s', or built without it.\n", optarg);
+					usage(argv[0]);
+					return 1;
+				}
 				break;
 			case 'V':
 				thisVersion(argv[0]);
 				return 0;
 				break;
 			case '?':
-				if (optopt == 't' || optopt == 'c')
+				if (optopt == 't' || optopt == 'i' || optopt == 'd' || optopt == 'S' ||
+				    optopt == 'x' || optopt == 'c' || optopt == 'b' || optopt == 'o' ||
+				    optopt == 'B' || optopt == 'g')
 					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 				else if (isprint (optopt))
 					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -102,158 +281,2222 @@ int main(int argc, char *argv[])
 				usage(argv[0]);
 			}
 
-	if (!(target >= -1 && interval > 0)) {
+	if (!(opts.target >= -1 && opts.interval > 0)) {
 		usage(argv[0]);
 		return 1;
 	}
 
-	dpy = XOpenDisplay(NULL);
-	if (dpy == NULL) {
-		fprintf(stderr, "couldn't open display\n");
+	/* -X only replaces the activity alarm of -x, the samples stay */
+	if (opts.rawInput && !opts.verify)
+		opts.verify = RAW_VERIFY;
+
+	if (opts.resume && (opts.target == -1 || opts.nthresholds > 0)) {
+		fprintf(stderr, "-r can't be combined with -s or a list of thresholds.\n");
 		return 1;
 	}
 
-	struct sigaction act;
-	memset (&act, '\0', sizeof(act));
- 
-	/* Use the sa_sigaction field because the handles has two additional parameters */
-	act.sa_sigaction = &signal_callback_handler;
-
-	/* The SA_SIGINFO flag tells sigaction() to use the sa_sigaction field, not sa_handler. */
-	act.sa_flags = SA_SIGINFO;
+	if (opts.aggregate && (opts.target == -1 || opts.bench || opts.format == FORMAT_BINARY)) {
+		fprintf(stderr, "-g can't be combined with -s, --bench or -o binary.\n");
+		return 1;
+	}
 
-	// Register signal and signal handler
-	if (sigaction(SIGTERM, &act, NULL) < 0) {
-		perror ("sigaction");
+	/* -W only has one loop, and nothing to tell -A or -M in advance */
+	if (opts.discover && (opts.target == -1 || opts.resume || opts.bench || opts.screens ||
+	                      opts.publish || opts.backend)) {
+		fprintf(stderr, "-W can't be combined with -s, -r, -A, -M, -B or --bench.\n");
 		return 1;
 	}
 
-	setlinebuf(stdout);
+	/* -W finds a restarted server on its own */
+	if (opts.reconnect && (opts.target == -1 || opts.resume || opts.bench || opts.screens ||
+	                       opts.discover || opts.backend)) {
+		fprintf(stderr, "--reconnect can't be combined with -s, -r, -A, -W, -B or --bench.\n");
+		return 1;
+	}
 
-	unsigned long current = 0;
-	while (target <= 0 || current < target) {
-		if (target != -1)
-			usleep(interval);
+	/* -r without -t waits in waitResume(), which doesn't write them */
+	if (opts.metricsPath && (opts.target == -1 || opts.bench ||
+	                         (opts.resume && opts.target == 0 && !opts.backend))) {
+		fprintf(stderr, "--metrics can't be combined with -s, --bench or -r without -t.\n");
+		return 1;
+	}
 
-		if (!XScreenSaverQueryExtension(dpy, &event_basep, &error_basep)) {
-			fprintf(stderr, "screen saver extension not supported\n");
+	if (onIdle || onResume) {
+		if (!opts.resume &&
+		    (opts.target == -1 || (opts.target == 0 && opts.nthresholds == 0))) {
+			fprintf(stderr, "--on-idle and --on-resume need -t or -r.\n");
 			return 1;
 		}
-
-		if (!XScreenSaverQueryInfo(dpy, DefaultRootWindow(dpy), &ssi)) {
-			fprintf(stderr, "couldn't query screen saver info\n");
+		/*
+		 * The hooks need to keep watching, so a single target is a
+		 * threshold, unless -r ends the run with the resume anyway.
+		 */
+		if (!opts.resume) {
+			opts.nthresholds = opts.nthresholds ? opts.nthresholds : 1;
+			opts.target = 0;
+		}
+		if ((onIdle && !(opts.onIdle = splitCommand(onIdle, shell))) ||
+		    (onResume && !(opts.onResume = splitCommand(onResume, shell)))) {
+			fprintf(stderr, "empty hook command\n");
 			return 1;
 		}
+	}
+
+	/* -r without -t waits in waitResume(), which has no socket */
+	if (opts.daemon && opts.resume && opts.target == 0 && !opts.backend) {
+		fprintf(stderr, "-D can't be combined with -r without -t.\n");
+		return 1;
+	}
+
+	/* without a safe place, -s asks the server itself */
+	if (!opts.socketPath && (opts.daemon || opts.target == -1) &&
+	    !(opts.socketPath = runtimeFile("xidletool.sock")) && opts.daemon)
+		return 1;
+	if (opts.publish && !(opts.shmPath = runtimeFile("xidletool.shm")))
+		return 1;
+
+	/* binary records are written out one by one in emitRecord() */
+	if (opts.flush || opts.format == FORMAT_BINARY)
+		setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+	else
+		setlinebuf(stdout);
 
-		current = workaroundCreepyXServer(dpy, ssi.idle);
-		if (target == -1) {
-			printf("%lu\n", current);
-			return 0;
+	/* a running daemon answers without a connection to the X server */
+	if (opts.target == -1 &&
+	    querySocket(&opts, names, nnames,
+	                opts.backend ? opts.backend->seat : XDisplayName(NULL)))
+		return 0;
+
+	if (opts.backend) {
+		if (opts.bench || opts.screens || opts.publish) {
+			fprintf(stderr, "--bench, -A and -M need the X server.\n");
+			return 1;
 		}
-		if (!quiet)
-			if (verbose)
-				printf("%lu - %lu\n", time(NULL), current);
-			else
-				printf("%lu\n", current);
+		if (opts.target != -1 && !setupSignals())
+			return 1;
+		return runBackend(opts.backend, &opts, names, nnames);
+	}
+
+	/* -s never looks at key events, so XOpenDisplay can skip setting up XKB */
+	oneshot = opts.target == -1 && !opts.bench;
+	if (oneshot)
+		XkbIgnoreExtension(True);
+
+	/*
+	 * -W opens the displays it finds in threads of its own, Xlib has to
+	 * know before its first call. A server going away only drops or
+	 * reopens its entry, ioError() replaces the message of Xlib's
+	 * default handler.
+	 */
+	if (opts.discover)
+		XInitThreads();
+	if (opts.discover || opts.reconnect)
+		XSetIOErrorHandler(ioError);
+	if (opts.reconnect)
+		srandom(getpid() ^ time(NULL));
+
+	/* without -d, just use $DISPLAY, -W starts with what it finds */
+	nAllDisplays = nnames ? nnames : !opts.discover;
+	allDisplays = calloc(nAllDisplays ? nAllDisplays : 1, sizeof(*allDisplays));
+	for (i = 0; i < nAllDisplays; i++) {
+		if (!openDisplay(&allDisplays[i], nnames ? names[i] : NULL, oneshot))
+			return 1;
+	}
+	free(names);
+	if (opts.screens)
+		nAllDisplays = expandScreens(&allDisplays, nAllDisplays);
+	for (i = 0; i < nAllDisplays; i++)
+		allDisplays[i].id = i;
+	nextId = nAllDisplays;
+	opts.tag = nAllDisplays > 1 || opts.discover;
+	opts.watch = opts.events && opts.target == 0 && opts.nthresholds == 0;
+	if (opts.publish && opts.target != -1 &&
+	    !createShm(opts.shmPath, allDisplays, nAllDisplays,
+	               opts.verify ? XIDLE_SHM_EXTRAPOLATE : 0))
+		return 1;
+
+	if (opts.bench)
+		return runBench(allDisplays, nAllDisplays, &opts);
+
+	if (opts.target == -1) {
+		if (!sampleAll(allDisplays, nAllDisplays))
+			return 1;
+		for (i = 0; i < nAllDisplays; i++)
+			printIdle(&opts, &allDisplays[i]);
+		return 0;
+	}
+
+	if (!setupSignals())
+		return 1;
+
+	/* with -r, the target is reached first if there is one */
+	if (opts.resume && opts.target == 0)
+		return waitResume(allDisplays, nAllDisplays, &opts);
+	status = runLoop(&opts);
+	if (status || !opts.resume || terminated)
+		return status;
+	return waitResume(allDisplays, nAllDisplays, &opts);
+}
+
+/*!
+ * Connect to the display \a name (NULL for $DISPLAY) and hand it to
+ * libxidle, which does the one time extension probes. With \a oneshot,
+ * for -s, it skips them and everything else only a loop would need.
+ *
+ * \return false if the display can't be used, the reason is printed
+ */
+bool openDisplay(struct display *d, const char *name, bool oneshot) {
+	Display *dpy;
+
+	memset(d, 0, sizeof(*d));
+	dpy = XOpenDisplay(name);
+	if (dpy == NULL) {
+		fprintf(stderr, "couldn't open display %s\n", XDisplayName(name));
+		return false;
+	}
+	return attachDisplay(d, dpy, oneshot);
+}
+
+/*!
+ * Set up \a d for the connection \a dpy, as openDisplay() does once it is
+ * open. -W connects in its own way and continues here.
+ *
+ * \return false if the display can't be used, the reason is printed. d->x
+ * is unset then and \a dpy is left open for the caller to close.
+ */
+bool attachDisplay(struct display *d, Display *dpy, bool oneshot) {
+	int error_basep;
+
+	memset(d, 0, sizeof(*d));
+	d->dpy = dpy;
+	d->name = DisplayString(d->dpy);
+	d->stale = true;
+	d->screen = DefaultScreen(d->dpy);
+	d->owner = d;
+	d->group = 1;
+
+	if (oneshot) {
+		d->x = xidle_attach_oneshot(d->dpy);
+		return d->x != NULL;
+	}
+	if (!XScreenSaverQueryExtension(d->dpy, &d->event_basep, &error_basep) ||
+	    !(d->x = xidle_attach(d->dpy))) {
+		fprintf(stderr, "%s: screen saver extension not supported\n", d->name);
+		return false;
+	}
+	return true;
+}
+
+uint64_t nsNow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* milliseconds from \a then to \a now */
+unsigned long msSince(const struct timespec *then, const struct timespec *now) {
+	return (now->tv_sec - then->tv_sec) * 1000 +
+		(now->tv_nsec - then->tv_nsec) / 1000000;
+}
+
+void timespecAddUs(struct timespec *ts, unsigned long us) {
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/* arm \a tfd for the absolute CLOCK_MONOTONIC \a deadline, repeating
+ * every \a interval microseconds unless that is 0 */
+void armTimer(int tfd, const struct timespec *deadline, unsigned long interval) {
+	struct itimerspec its;
+
+	its.it_value = *deadline;
+	its.it_interval.tv_sec = interval / 1000000;
+	its.it_interval.tv_nsec = (interval % 1000000) * 1000;
+	timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* runLoop()'s pollfds, the connections of the displays follow these */
+enum { POLL_TIMER, POLL_LISTEN, POLL_SIGNAL, POLL_DISCOVER, POLL_SUMMARY, POLL_METRICS, POLL_DISPLAYS };
+
+/*!
+ * Set up \a d for runLoop(): the alarms it waits on and the events it
+ * selects.
+ *
+ * \return false on a fatal error, the reason is printed
+ */
+static bool watchDisplay(struct display *d, const struct options *opts) {
+#ifdef HAVE_XSETIOERROREXITHANDLER
+	/* before the first request, a thread of -W may have set one */
+	if (opts->discover || opts->reconnect)
+		XSetIOErrorExitHandler(d->dpy, displayLost, NULL);
+#endif
+	if (opts->alarm && opts->target > 0) {
+		d->alarm = xidle_create_alarm(d->x, opts->target, XSyncPositiveComparison);
+		if (d->alarm == None && opts->verbose)
+			fprintf(stderr, "%s: IDLETIME counter not available, polling\n", d->name);
+	}
+#ifdef USE_XINPUT2
+	if (opts->rawInput && !d->shared && !openRawInput(d))
+		return false;
+#endif
+	if (opts->verify && !opts->rawInput) {
+		/*
+		 * Input after at least one interval of idle time moves the
+		 * counter down through the interval. Below that the alarm
+		 * stays quiet, so those samples aren't extrapolated and the
+		 * display is sampled every interval until it gets there.
+		 */
+		d->activity = xidle_create_alarm(d->x, opts->interval / 1000, XSyncNegativeTransition);
+		d->noticed = d->activity != None ? opts->interval / 1000 : ULONG_MAX;
+		if (d->activity == None && opts->verbose)
+			fprintf(stderr, "%s: IDLETIME counter not available, sampling every interval\n",
+			        d->name);
+	}
+	if (opts->watch || opts->verify)
+		XScreenSaverSelectInput(d->dpy, RootWindow(d->dpy, d->screen), ScreenSaverNotifyMask);
+	XFlush(d->dpy);
+	return true;
+}
+
+/*!
+ * -W, --reconnect: Xlib lost the connection of \a dpy. \a data is the lost flag of an
+ * entry that isn't in displays yet, NULL to look it up. Instead of exiting,
+ * Xlib returns to the caller, which finds nothing more to read.
+ */
+void displayLost(Display *dpy, void *data) {
+	int i;
+
+	if (data) {
+		*(bool *) data = true;
+		return;
 	}
-	if (!quiet && target > 0)
-		printf("Reached idle target: %lu | timestamp: %lu\n", current, time(NULL));
+	for (i = 0; i < nAllDisplays; i++)
+		if (allDisplays[i].dpy == dpy)
+			allDisplays[i].lost = true;
+}
 
+/* Xlib's message without the exit, see displayLost() */
+static int ioError(Display *dpy) {
+	fprintf(stderr, "%s: lost connection to display\n", DisplayString(dpy));
 	return 0;
 }
 
-static void signal_callback_handler(int sig, siginfo_t *siginfo, void *context) {
-	XCloseDisplay(dpy);
+/*
+ * The host of display \a name, without the protocol and with "unix" as
+ * none, in \a host, its number in \a number and its screen in \a screen,
+ * -1 if it has none.
+ *
+ * \return false if \a name isn't [protocol/][host]:number[.screen]
+ */
+static bool parseDisplayName(const char *name, char *host, size_t size, long *number, long *screen) {
+	const char *colon, *slash;
+	size_t len;
+	char *end;
+
+	if (!(colon = strrchr(name, ':')))
+		return false;
+	if ((slash = strchr(name, '/')) && slash < colon)
+		name = slash + 1;
+	len = colon - name;
+	/* host::number is DECnet */
+	if (len && name[len - 1] == ':')
+		len--;
+	if (len >= size)
+		return false;
+	memcpy(host, name, len);
+	host[len] = '\0';
+	if (!strcmp(host, "unix"))
+		host[0] = '\0';
+	*number = strtol(colon + 1, &end, 10);
+	if (end == colon + 1)
+		return false;
+	*screen = -1;
+	if (*end == '.')
+		*screen = strtol(end + 1, &end, 10);
+	return *end == '\0';
 }
 
-void usage(char *name)
-{
-	fprintf(stderr,
-		"Usage:\n"
-		"%s [-s] [-t target] [-i interval] [-q] [-v]\n"
-		"  -s\n"
-		"       print the current idle time and exit\n"
-		"  -i interval (in milliseconds)\n"
-		"       check idle time every <interval> milliseconds\n"
-		"  -t target (in milliseconds)\n"
-		"       run until system has been idle for target milliseconds\n"
-		"  -q\n"
-		"       be quiet, don't print anything (only useful when in target mode)\n"
-		"  -v\n"
-		"       print timestamp and ideltime(default is only ideltime)\n"
-		"  -V\n"
-		"       show version and authors\n"
-		"\n"
-		"Note that -s and -t are mutually exclusive, only the last one matters.\n"
-		"By default, %s runs indefinitely with an interval of 1000 milliseconds.\n"
-		"The user's idle time in milliseconds is printed on stdout.\n",
-		name, name);
+/*
+ * true if the display names \a a and \a b are the same server, with
+ * \a screens also the same screen, where a name without one means 0
+ */
+static bool sameDisplay(const char *a, const char *b, bool screens) {
+	char hostA[256], hostB[256];
+	long numberA, numberB, screenA, screenB;
+
+	if (!strcmp(a, b))
+		return true;
+	if (!parseDisplayName(a, hostA, sizeof(hostA), &numberA, &screenA) ||
+	    !parseDisplayName(b, hostB, sizeof(hostB), &numberB, &screenB) ||
+	    numberA != numberB || strcmp(hostA, hostB))
+		return false;
+	return !screens || (screenA < 0 ? 0 : screenA) == (screenB < 0 ? 0 : screenB);
 }
 
-void thisVersion(char *name) {
-	printf(	"%s v. %s\n"
-		"\n"
-		"AUTHORS:\n"
-		"Copyright (c) 2005, 2008 Magnus Henoch <henoch@dtek.chalmers.se>\n"
-		"Copyright (c) 2006, 2007 by Danny Kukawka\n"
-		"                         <dkukawka@suse.de>, <danny.kukawka@web.de>\n"
-		"Copyright (c) 2008 Eivind Magnus Hvidevold <hvidevold@gmail.com>\n"
-		"Copyright (c) 2014 Alex Alexander\n"
-		"                   <wired@gentoo.org> <alex.alexander@gmail.com>\n"
-		"Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>\n",
-		name, VERSION);
+/* the entry of the display called \a name or another name of it, or NULL */
+struct display *findDisplay(const char *name) {
+	int i;
+
+	/* -W has no -A, an entry is its server */
+	for (i = 0; i < nAllDisplays; i++)
+		if (sameDisplay(allDisplays[i].name, name, false))
+			return &allDisplays[i];
+	return NULL;
+}
+
+/* point every entry at itself again after displays has moved, -W has no -A */
+static void ownDisplays(void) {
+	int i;
+
+	for (i = 0; i < nAllDisplays; i++)
+		allDisplays[i].owner = &allDisplays[i];
+	displaysChanged = true;
+}
+
+/*!
+ * -W: watch \a d, just opened by the discovery, from the next iteration of
+ * runLoop() on. It is sampled with the next tick.
+ *
+ * \return false if it can't be watched, it is dropped then
+ */
+bool addDisplay(struct display *d, const struct options *opts) {
+	struct display *n;
+
+	allDisplays = realloc(allDisplays, (nAllDisplays + 1) * sizeof(*allDisplays));
+	n = &allDisplays[nAllDisplays++];
+	*n = *d;
+	n->id = nextId++;
+	ownDisplays();
+
+	if (!watchDisplay(n, opts)) {
+		n->lost = true;
+		return false;
+	}
+	if (opts->verbose)
+		fprintf(stderr, "%s: watching\n", n->name);
+	sampleSoon = true;
+	return true;
+}
+
+/* -W: close the displays whose server or socket went away */
+static void dropLost(const struct options *opts) {
+	struct timespec now;
+	int i, n = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < nAllDisplays; i++) {
+		if (!allDisplays[i].lost) {
+			if (n != i)
+				allDisplays[n] = allDisplays[i];
+			n++;
+			continue;
+		}
+		if (opts->verbose)
+			fprintf(stderr, "%s: dropped\n", allDisplays[i].name);
+		/* -g: the session is over, so is its window */
+		if (opts->aggregate)
+			printSummary(opts, &allDisplays[i], &now, false);
+		xidle_close(allDisplays[i].x);
+	}
+	if (n != nAllDisplays) {
+		nAllDisplays = n;
+		ownDisplays();
+	}
+}
+
+/* milliseconds from \a now to \a then, negative once it has passed */
+static long msUntil(const struct timespec *now, const struct timespec *then) {
+	return (then->tv_sec - now->tv_sec) * 1000 + (then->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+/* the next try to open \a d again, with jitter so that all the processes
+ * that lost the same server don't come back at once */
+static void scheduleRetry(struct display *d, const struct timespec *now) {
+	d->retry = *now;
+	timespecAddUs(&d->retry, (d->backoff / 2 + random() % (d->backoff / 2 + 1)) * 1000);
+	d->backoff = d->backoff * 2 < RECONNECT_MAX ? d->backoff * 2 : RECONNECT_MAX;
+}
+
+/*!
+ * --reconnect: open \a d again. The new connection gets the extension
+ * probes, DPMS state, alarms and selections of a fresh one, the entry keeps
+ * its id, -M record and what the thresholds and target have seen, so the
+ * next sample continues from there: a restarted server has seen no input,
+ * a reset is reported as one.
+ */
+static void reconnectDisplay(struct display *d, const struct options *opts, const struct timespec *now) {
+	struct display keep = *d;
+	bool lost = false;
+	Display *dpy;
+
+	dpy = XOpenDisplay(keep.name);
+	if (dpy) {
+#ifdef HAVE_XSETIOERROREXITHANDLER
+		XSetIOErrorExitHandler(dpy, displayLost, &lost);
+#endif
+		if (!attachDisplay(d, dpy, false) || lost) {
+			if (d->x)
+				xidle_close(d->x);
+			else
+				XCloseDisplay(dpy);
+			dpy = NULL;
+		}
+	}
+	if (!dpy) {
+		*d = keep;
+		scheduleRetry(d, now);
+		return;
+	}
+
+	d->id = keep.id;
+	d->shm = keep.shm;
+	d->reached = keep.reached;
+	d->crossed = keep.crossed;
+	d->printed = keep.printed;
+	d->last = keep.last;
+	d->current = keep.current;
+	d->summary = keep.summary;
+	free((char *) keep.name);
+	displaysChanged = true;
+	if (!watchDisplay(d, opts)) {
+		d->backoff = keep.backoff;
+		d->lost = true;
+		return;
+	}
+	fprintf(stderr, "%s: reconnected\n", d->name);
+	sampleSoon = true;
+}
+
+/*!
+ * --reconnect: close the connections that were lost and open those whose
+ * time has come again. Until then the entry keeps its name but no
+ * connection.
+ *
+ * \return ms until the next try, -1 if there is none
+ */
+static int retryLost(const struct options *opts) {
+	struct timespec now;
+	struct display *d;
+	long wait, next = -1;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < nAllDisplays; i++) {
+		d = &allDisplays[i];
+		if (!d->lost)
+			continue;
+		if (d->x) {
+			d->name = strdup(d->name);
+			xidle_close(d->x);
+			d->x = NULL;
+			d->dpy = NULL;
+			d->alarm = d->activity = None;
+			d->inflight = d->motionMuted = false;
+			if (!d->backoff)
+				d->backoff = RECONNECT_FIRST;
+			scheduleRetry(d, &now);
+			displaysChanged = true;
+		} else if (msUntil(&now, &d->retry) <= 0) {
+			reconnectDisplay(d, opts, &now);
+			if (!d->lost) {
+				d->backoff = 0;
+				continue;
+			}
+		}
+		/* rounded up, poll() would wake up just before */
+		wait = msUntil(&now, &d->retry) + 1;
+		if (wait < 0)
+			wait = 0;
+		if (next < 0 || wait < next)
+			next = wait;
+	}
+	return next;
+}
+
+/* the display part of \a pfds for the entries there are now */
+static struct pollfd *pollDisplays(struct pollfd *pfds) {
+	int i;
+
+	pfds = realloc(pfds, (POLL_DISPLAYS + nAllDisplays) * sizeof(*pfds));
+	for (i = 0; i < nAllDisplays; i++) {
+		/* the owner of a shared connection reads it for all screens */
+		pfds[POLL_DISPLAYS + i].fd = allDisplays[i].shared || !allDisplays[i].dpy ?
+			-1 : ConnectionNumber(allDisplays[i].dpy);
+		pfds[POLL_DISPLAYS + i].events = POLLIN;
+	}
+	displaysChanged = false;
+	return pfds;
 }
 
 /*!
- * This function works around an XServer idleTime bug in the
- * XScreenSaverExtension if dpms is running. In this case the current
- * dpms-state time is always subtracted from the current idletime.
- * This means: XScreenSaverInfo->idle is not the time since the last
- * user activity, as descriped in the header file of the extension.
- * This result in SUSE bug # and sf.net bug #. The bug in the XServer itself
- * is reported at https://bugs.freedesktop.org/buglist.cgi?quicksearch=6439.
+ * The main loop. All waiting is done in a single poll() on a timerfd and
+ * the connections of all displays, so X events are handled while waiting
+ * for the next sample. The timer runs on absolute CLOCK_MONOTONIC
+ * deadlines: in the default mode it is periodic, so the query latency
+ * doesn't add up to a drift of the sampling period; with -p it is re-armed
+ * as a one shot for the earliest moment a target can be reached. On every
+ * tick all displays are sampled together, so the number of wakeups doesn't
+ * grow with the number of displays.
  *
- * Workaround: Check if if XServer is in a dpms state, check the 
- *             current timeout for this state and add this value to 
- *             the current idle time and return.
+ * Without a timer, the loop is driven by X events only: ScreenSaverNotify
+ * for -e and the IDLETIME AlarmNotify for -a.
  *
- * \param _idleTime a unsigned long value with the current idletime from
- *                  XScreenSaverInfo->idle
- * \return a unsigned long with the corrected idletime
- */
-unsigned long workaroundCreepyXServer(Display *dpy, unsigned long _idleTime ){
-	int dummy;
-	CARD16 standby, suspend, off;
-	CARD16 state;
-	BOOL onoff;
-
-	if (DPMSQueryExtension(dpy, &dummy, &dummy)) {
-		if (DPMSCapable(dpy)) {
-			DPMSGetTimeouts(dpy, &standby, &suspend, &off);
-			DPMSInfo(dpy, &state, &onoff);
-
-			if (onoff) {
-				switch (state) {
-					case DPMSModeStandby:
-						/* this check is a littlebit paranoid, but be sure */
-						if (_idleTime < (unsigned) (standby * 1000))
-							_idleTime += (standby * 1000);
-						break;
-					case DPMSModeSuspend:
-						if (_idleTime < (unsigned) ((suspend + standby) * 1000))
-							_idleTime += ((suspend + standby) * 1000);
-						break;
-					case DPMSModeOff:
-						if (_idleTime < (unsigned) ((off + suspend + standby) * 1000))
-							_idleTime += ((off + suspend + standby) * 1000);
-						break;
-					case DPMSModeOn:
-					default:
-						break;
+ * With -W, displays come and go between two iterations, it runs until it
+ * is terminated.
+ *
+ * \return the exit status for main()
+ */
+int runLoop(const struct options *opts) {
+	struct pollfd *pfds;
+	struct timespec deadline, now;
+	int lfd = -1, dfd = -1, gtfd = -1, mtfd = -1;
+	uint64_t expirations;
+	unsigned long remaining;
+	struct timespec flushed;
+	bool polling = opts->discover && !opts->watch, tick, forced;
+	/* -p re-arms the timer after each tick, for the next target only */
+	bool oneShot = opts->adaptive && (opts->target > 0 || opts->nthresholds > 0);
+	int pending = nAllDisplays;   /* displays that haven't reached the target */
+	int tfd, i, timeout, retry = -1;
+
+	if (opts->daemon && (lfd = listenSocket(opts->socketPath)) < 0)
+		return 1;
+
+	for (i = 0; i < nAllDisplays; i++) {
+		if (!watchDisplay(&allDisplays[i], opts))
+			return 1;
+		if (allDisplays[i].alarm == None && !opts->watch)
+			polling = true;
+	}
+	pfds = pollDisplays(calloc(POLL_DISPLAYS, sizeof(*pfds)));
+
+#ifdef USE_DISCOVER
+	if (opts->discover && (dfd = discoverStart()) < 0)
+		return 1;
+#endif
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		perror("timerfd_create");
+		return 1;
+	}
+	pfds[POLL_TIMER].fd = tfd;
+	pfds[POLL_LISTEN].fd = lfd;
+	pfds[POLL_SIGNAL].fd = signalPipe[0];
+	pfds[POLL_DISCOVER].fd = dfd;
+
+	clock_gettime(CLOCK_MONOTONIC, &flushed);
+
+	/* -g windows, aligned to the start of the run */
+	if (opts->aggregate && opts->window) {
+		gtfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (gtfd < 0) {
+			perror("timerfd_create");
+			return 1;
+		}
+		deadline = flushed;
+		timespecAddUs(&deadline, opts->window * 1000);
+		armTimer(gtfd, &deadline, opts->window * 1000);
+	}
+	pfds[POLL_SUMMARY].fd = gtfd;
+	if (opts->metricsPath && (mtfd = metricsTimer(opts)) < 0)
+		return 1;
+	pfds[POLL_METRICS].fd = mtfd;
+	for (i = 0; i < POLL_DISPLAYS; i++)
+		pfds[i].events = POLLIN;
+
+	if (polling) {
+		/* with -p, take the first sample right away */
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		if (!oneShot) {
+			timespecAddUs(&deadline, opts->interval);
+			armTimer(tfd, &deadline, opts->interval);
+		} else
+			armTimer(tfd, &deadline, 0);
+	}
+
+	while (pending > 0 || opts->discover) {
+		if (opts->discover)
+			dropLost(opts);
+		else if (opts->reconnect)
+			retry = retryLost(opts);
+		if (displaysChanged)
+			pfds = pollDisplays(pfds);
+		/*
+		 * -p: a tick that found nothing to wait for left the timer
+		 * disarmed, so a display that joined or came back since is
+		 * sampled now.
+		 */
+		if (sampleSoon) {
+			sampleSoon = false;
+			if (oneShot && polling) {
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				armTimer(tfd, &deadline, 0);
+			}
+		}
+
+		/* handle everything Xlib has queued before blocking */
+		for (i = 0; i < nAllDisplays; i++)
+			if (!handleXEvents(&allDisplays[i], opts))
+				return 1;
+		for (i = pending = 0; i < nAllDisplays; i++)
+			pending += !allDisplays[i].reached;
+		if (pending == 0 && !opts->discover)
+			break;
+
+		/*
+		 * With -b, output stays in the stdio buffer until flush ms after
+		 * the last flush, however the loop is woken up.
+		 */
+		timeout = -1;
+		if (opts->flush && __fpending(stdout) > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (msSince(&flushed, &now) >= opts->flush) {
+				fflush(stdout);
+				flushed = now;
+			} else
+				timeout = opts->flush - msSince(&flushed, &now);
+		}
+		if (retry >= 0 && (timeout < 0 || retry < timeout))
+			timeout = retry;
+
+		if (poll(pfds, POLL_DISPLAYS + nAllDisplays, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+		stats.wakeups++;
+
+		/* SIGTERM and SIGINT end the loop, SIGUSR2 samples right away */
+		tick = forced = false;
+		if (pfds[POLL_SIGNAL].revents & POLLIN) {
+			unsigned char sig;
+
+			while (read(signalPipe[0], &sig, 1) == 1) {
+				if (sig == SIGUSR1) {
+					dumpStats();
+					if (opts->aggregate)
+						printSummaries(opts, allDisplays, nAllDisplays, false);
+				} else if (sig == SIGCHLD)
+					reapHooks();
+				else if (sig == SIGUSR2)
+					tick = forced = true;
+				else
+					terminated = true;
+			}
+			if (terminated)
+				break;
+		}
+		for (i = 0; i < nAllDisplays; i++)
+			if (pfds[POLL_DISPLAYS + i].revents & (POLLERR | POLLHUP)) {
+				/* otherwise ioError() says so when it is closed */
+				if (!opts->discover && !opts->reconnect) {
+					fprintf(stderr, "%s: lost connection to display\n", allDisplays[i].name);
+					return 1;
 				}
+				allDisplays[i].lost = true;
+			}
+		if (pfds[POLL_LISTEN].revents & POLLIN)
+			serveClient(lfd, allDisplays, nAllDisplays, opts->verify);
+#ifdef USE_DISCOVER
+		/* new displays only get a pollfd with the next iteration */
+		if (pfds[POLL_DISCOVER].revents & POLLIN)
+			discoverDispatch(opts);
+#endif
+		if ((pfds[POLL_TIMER].revents & POLLIN) &&
+		    read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+			stats.overruns += expirations - 1;
+			tick = true;
+		}
+		if ((pfds[POLL_SUMMARY].revents & POLLIN) &&
+		    read(gtfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			printSummaries(opts, allDisplays, nAllDisplays, true);
+		if ((pfds[POLL_METRICS].revents & POLLIN) &&
+		    read(mtfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+			sampleWaiting(allDisplays, nAllDisplays);
+			writeMetrics(opts, allDisplays, nAllDisplays);
+		}
+		if (!tick)
+			continue;
+#ifdef USE_XINPUT2
+		/* -X: motion counts again, once until the next tick */
+		for (i = 0; i < nAllDisplays; i++)
+			if (allDisplays[i].motionMuted && !allDisplays[i].lost) {
+				selectRawInput(&allDisplays[i], true);
+				XFlush(allDisplays[i].dpy);
+			}
+#endif
+
+		/*
+		 * With -x only displays due for verification, or whose last
+		 * sample is too short for the activity alarm to notice input,
+		 * are asked; the others continue from their last sample.
+		 * Activity in between has re-sampled them through their
+		 * activity alarm already. SIGUSR2 asks all of them.
+		 */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < nAllDisplays; i++)
+			if (forced || !opts->verify || !extrapolates(&allDisplays[i]) ||
+			    msSince(&allDisplays[i].sampled, &now) >= opts->verify)
+				allDisplays[i].stale = true;
+		if (!sampleAll(allDisplays, nAllDisplays))
+			return 1;
+		if (opts->verify) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			for (i = 0; i < nAllDisplays; i++)
+				if (extrapolates(&allDisplays[i]))
+					extrapolateIdle(&allDisplays[i], &now);
+		}
+
+		remaining = ULONG_MAX;
+		for (i = 0; i < nAllDisplays; i++) {
+			struct display *d = &allDisplays[i];
+
+			if (d->reached || d->alarm != None || d->lost)
+				continue;
+			printIdle(opts, d);
+
+			if (opts->nthresholds > 0) {
+				remaining = checkThresholds(opts, d, remaining);
+				continue;
 			}
+			if (opts->target <= 0)
+				continue;
+			if (d->current >= (unsigned long) opts->target) {
+				printReached(opts, d);
+				d->reached = true;
+				pending--;
+			} else if (opts->target - d->current < remaining)
+				remaining = opts->target - d->current;
+		}
+
+		if (oneShot && remaining != ULONG_MAX) {
+			/*
+			 * Idle time grows by exactly one millisecond per millisecond,
+			 * so no target can be reached before target - current ms
+			 * have passed. Activity in between just shortens current and
+			 * the next deadline is computed from there.
+			 *
+			 * Once thresholds are crossed, they are only left through
+			 * activity, so those displays keep the deadline at most one
+			 * interval away to notice the reset in time.
+			 */
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			timespecAddUs(&deadline, remaining * 1000);
+			armTimer(tfd, &deadline, 0);
 		}
 	}
 
-	return _idleTime;
+	if (opts->aggregate)
+		printSummaries(opts, allDisplays, nAllDisplays, false);
+	for (i = 0; i < nAllDisplays; i++) {
+		if (allDisplays[i].lost)
+			continue;
+		if (allDisplays[i].alarm != None)
+			XSyncDestroyAlarm(allDisplays[i].dpy, allDisplays[i].alarm);
+		if (allDisplays[i].activity != None)
+			XSyncDestroyAlarm(allDisplays[i].dpy, allDisplays[i].activity);
+		allDisplays[i].alarm = allDisplays[i].activity = None;
+	}
+#ifdef USE_DISCOVER
+	if (opts->discover)
+		discoverStop();
+#endif
+	close(tfd);
+	if (gtfd >= 0)
+		close(gtfd);
+	if (mtfd >= 0) {
+		close(mtfd);
+		unlink(opts->metricsPath);
+	}
+	free(pfds);
+	if (lfd >= 0) {
+		close(lfd);
+		unlink(opts->socketPath);
+	}
+
+	return 0;
+}
+
+/*!
+ * Block until there is input on one of the displays, for -r. A negative
+ * transition IDLETIME alarm at 1 ms fires with the first input event, and
+ * ScreenSaverNotify with the screen saver turning off. Displays without
+ * the IDLETIME counter are polled every interval instead, there input is
+ * noticed when the idle time is below what the last sample plus the time
+ * since would be.
+ *
+ * \return the exit status for main()
+ */
+int waitResume(struct display *displays, int ndisplays, const struct options *opts) {
+	struct pollfd *pfds;
+	struct timespec deadline, now, sampled;
+	struct display *d, *resumed = NULL;
+	uint64_t expirations;
+	unsigned long expected, base;
+	bool polling = false;
+	int tfd, i;
+	XEvent ev;
+
+	for (i = 0; i < ndisplays; i++) {
+		displays[i].reached = false;
+		displays[i].stale = true;
+	}
+	if (!sampleAll(displays, ndisplays))
+		return 1;
+
+	pfds = calloc(ndisplays + 2, sizeof(*pfds));
+	for (i = 0; i < ndisplays; i++) {
+		d = &displays[i];
+		d->activity = xidle_create_alarm(d->x, 1, XSyncNegativeTransition);
+		if (d->activity == None) {
+			if (opts->verbose)
+				fprintf(stderr, "%s: IDLETIME counter not available, polling\n", d->name);
+			polling = true;
+		}
+		XScreenSaverSelectInput(d->dpy, RootWindow(d->dpy, d->screen), ScreenSaverNotifyMask);
+		XFlush(d->dpy);
+		pfds[i + 1].fd = d->shared ? -1 : ConnectionNumber(d->dpy);
+		pfds[i + 1].events = POLLIN;
+	}
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		perror("timerfd_create");
+		return 1;
+	}
+	pfds[0].fd = tfd;
+	pfds[0].events = POLLIN;
+	pfds[ndisplays + 1].fd = signalPipe[0];
+	pfds[ndisplays + 1].events = POLLIN;
+	if (polling) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		timespecAddUs(&deadline, opts->interval);
+		armTimer(tfd, &deadline, opts->interval);
+	}
+
+	while (!resumed) {
+		for (i = 0; i < ndisplays && !resumed; i++) {
+			struct display *t;
+			XSyncAlarm alarm;
+
+			d = &displays[i];
+			while (!resumed && !d->shared && XPending(d->dpy)) {
+				XNextEvent(d->dpy, &ev);
+				if (xidle_handle_event(d->x, &ev))
+					continue;
+				alarm = xidle_alarm_event(d->x, &ev);
+				t = eventTarget(d, &ev, alarm);
+				if ((alarm != None && alarm == t->activity) ||
+				    (ev.type == d->event_basep + ScreenSaverNotify &&
+				     ((XScreenSaverNotifyEvent *) &ev)->state == ScreenSaverOff)) {
+					/* the idle period ended just now */
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					extrapolateIdle(t, &now);
+					resumed = t;
+				}
+			}
+		}
+		if (resumed)
+			break;
+
+		if (poll(pfds, ndisplays + 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+		stats.wakeups++;
+
+		if (pfds[ndisplays + 1].revents & POLLIN) {
+			unsigned char sig;
+
+			while (read(signalPipe[0], &sig, 1) == 1) {
+				if (sig == SIGUSR1)
+					dumpStats();
+				else if (sig == SIGCHLD)
+					reapHooks();
+				else if (sig != SIGUSR2)
+					terminated = true;
+			}
+			if (terminated)
+				break;
+		}
+		for (i = 0; i < ndisplays; i++)
+			if (pfds[i + 1].revents & (POLLERR | POLLHUP)) {
+				fprintf(stderr, "%s: lost connection to display\n", displays[i].name);
+				return 1;
+			}
+		if (!(pfds[0].revents & POLLIN) ||
+		    read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			continue;
+		stats.overruns += expirations - 1;
+
+		for (i = 0; i < ndisplays && !resumed; i++) {
+			d = &displays[i];
+			if (d->activity != None)
+				continue;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			extrapolateIdle(d, &now);
+			expected = d->current;
+			base = d->base;
+			sampled = d->sampled;
+			d->stale = true;
+			if (!sampleAll(d, 1))
+				return 1;
+			if (d->current + RESUME_SLACK < expected) {
+				/*
+				 * The idle period ended d->current ms ago, report it
+				 * relative to the sample it started from.
+				 */
+				d->current = expected - d->current;
+				d->base = base;
+				d->sampled = sampled;
+				resumed = d;
+			}
+		}
+	}
+
+	for (i = 0; i < ndisplays; i++) {
+		if (displays[i].activity != None)
+			XSyncDestroyAlarm(displays[i].dpy, displays[i].activity);
+		displays[i].activity = None;
+		XFlush(displays[i].dpy);
+	}
+	close(tfd);
+	free(pfds);
+
+	if (resumed)
+		printResumed(opts, resumed);
+	return 0;
+}
+
+/*!
+ * Dispatch the events Xlib has queued for \a d. ScreenSaverNotify causes a
+ * sample in -e mode, the IDLETIME alarm marks the target as reached. With
+ * -x, both ScreenSaverNotify and the activity alarm make the last sample
+ * invalid, so a fresh one is taken right away.
+ *
+ * \return false on a fatal error
+ */
+bool handleXEvents(struct display *d, const struct options *opts) {
+	struct display *t;
+	XEvent ev;
+	XSyncAlarm alarm;
+
+	/* with -A, the owner reads the events of all screens */
+	while (!d->shared && !d->lost && XPending(d->dpy)) {
+		XNextEvent(d->dpy, &ev);
+		if (xidle_handle_event(d->x, &ev))
+			continue;
+#ifdef USE_XINPUT2
+		if (opts->rawInput && ev.type == GenericEvent &&
+		    ev.xcookie.extension == d->xiOpcode) {
+			rawInput(d, &ev);
+			continue;
+		}
+#endif
+
+		alarm = xidle_alarm_event(d->x, &ev);
+		t = eventTarget(d, &ev, alarm);
+		if (t->reached)
+			continue;
+
+		if ((opts->watch || opts->verify) &&
+		    (ev.type == d->event_basep + ScreenSaverNotify ||
+		     (alarm != None && alarm == t->activity))) {
+			t->stale = true;
+			if (!sampleAll(t, 1))
+				return false;
+			if (opts->watch)
+				printIdle(opts, t);
+		} else if (alarm != None && alarm == t->alarm) {
+			t->current = t->base = opts->target;
+			clock_gettime(CLOCK_MONOTONIC, &t->sampled);
+			t->reached = true;
+			printReached(opts, t);
+		}
+	}
+
+	return true;
+}
+
+#ifdef USE_XINPUT2
+/*!
+ * -X: ask for XInput 2.2, which sends raw events to the root window even
+ * while another client has grabbed the device, and select them.
+ *
+ * \return false with the reason printed if the server can't
+ */
+bool openRawInput(struct display *d) {
+	int event, error, major = 2, minor = 2;
+
+	if (!XQueryExtension(d->dpy, "XInputExtension", &d->xiOpcode, &event, &error) ||
+	    XIQueryVersion(d->dpy, &major, &minor) != Success) {
+		fprintf(stderr, "%s: XInput 2.2 not supported\n", d->name);
+		return false;
+	}
+	selectRawInput(d, true);
+	return true;
+}
+
+/* select raw key and button presses of all master devices, and motion */
+void selectRawInput(struct display *d, bool motion) {
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+	XIEventMask mask;
+
+	memset(bits, 0, sizeof(bits));
+	XISetMask(bits, XI_RawKeyPress);
+	XISetMask(bits, XI_RawButtonPress);
+	if (motion)
+		XISetMask(bits, XI_RawMotion);
+	mask.deviceid = XIAllMasterDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+	XISelectEvents(d->dpy, DefaultRootWindow(d->dpy), &mask, 1);
+	d->motionMuted = !motion;
+}
+
+/*!
+ * -X: a raw event on the connection of \a d, all its screens had input
+ * just now. That is all there is to know, the event data isn't even
+ * fetched. The first motion deselects motion until the next tick, so
+ * moving the mouse costs one event per interval instead of hundreds.
+ */
+void rawInput(struct display *d, XEvent *ev) {
+	struct timespec now;
+	struct display *m;
+	int k;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (k = 0; k < d->group; k++) {
+		m = d + k;
+		m->current = m->base = 0;
+		m->sampled = now;
+		publishSample(m);
+	}
+	if (ev->xcookie.evtype == XI_RawMotion && !d->motionMuted) {
+		selectRawInput(d, false);
+		XFlush(d->dpy);
+	}
+}
+#endif
+
+/*!
+ * The entry of the connection of \a d an event is about: the one whose
+ * \a alarm it is, or whose root window a ScreenSaverNotify is for. Without
+ * -A that is \a d itself.
+ */
+struct display *eventTarget(struct display *d, XEvent *ev, XSyncAlarm alarm) {
+	struct display *m;
+	int k;
+
+	for (k = 0; k < d->group; k++) {
+		m = d + k;
+		if (alarm != None && (alarm == m->alarm || alarm == m->activity))
+			return m;
+		if (ev->type == d->event_basep + ScreenSaverNotify &&
+		    ((XScreenSaverNotifyEvent *) ev)->root == RootWindow(d->dpy, m->screen))
+			return m;
+	}
+	return d;
+}
+
+/*!
+ * -A: replace every display with one entry per screen, named like
+ * DISPLAY=:0.N would name it. The entries of a display share its
+ * connection and libxidle handle, the first one owns them and samples all
+ * screens with a single flush.
+ *
+ * \return the new number of entries in \a *displays
+ */
+int expandScreens(struct display **displays, int ndisplays) {
+	struct display *all = NULL, *d;
+	const char *colon, *dot;
+	char *name;
+	int n = 0, i, k, screens;
+
+	for (i = 0; i < ndisplays; i++) {
+		d = &(*displays)[i];
+		screens = ScreenCount(d->dpy);
+		all = realloc(all, (n + screens) * sizeof(*all));
+		if (screens > 1)
+			xidle_all_screens(d->x);
+
+		colon = strrchr(d->name, ':');
+		dot = colon ? strchr(colon, '.') : NULL;
+		for (k = 0; k < screens; k++) {
+			all[n + k] = *d;
+			all[n + k].screen = k;
+			all[n + k].shared = k > 0;
+			if (screens > 1 &&
+			    asprintf(&name, "%.*s.%d", dot ? (int) (dot - d->name) : (int) strlen(d->name),
+			             d->name, k) > 0)
+				all[n + k].name = name;
+		}
+		all[n].group = screens;
+		n += screens;
+	}
+	for (i = 0; i < n; i++)
+		all[i].owner = all[i].shared ? all[i - 1].owner : &all[i];
+
+	free(*displays);
+	*displays = all;
+	return n;
+}
+
+/*!
+ * The idle time of \a d at \a now, assuming there was no input since the
+ * last sample: the server's value plus the time that has passed.
+ */
+void extrapolateIdle(struct display *d, const struct timespec *now) {
+	d->current = d->base + msSince(&d->sampled, now);
+}
+
+/*!
+ * -x: the last sample of \a d may be carried forward with the clock. Input
+ * is only noticed at once from d->noticed ms of idle time on, before that
+ * the user may well be typing away and the sample holds until the next.
+ */
+bool extrapolates(const struct display *d) {
+	return d->base >= d->noticed;
+}
+
+/* \a d needs a sample from the server */
+static bool wantsSample(const struct display *d) {
+	return d->stale && !d->reached && d->alarm == None && !d->lost;
+}
+
+/* -a: \a d waits on its alarm and has no sample since it was set */
+static bool waitsOnAlarm(const struct display *d) {
+	return d->alarm != None && !d->reached && !d->lost;
+}
+
+/*
+ * Sample the displays \a wants picks: first every request is sent, then
+ * the replies are collected, so with XCB the round trips to different
+ * servers overlap. The screens of one connection are sampled together
+ * through their owner.
+ */
+static bool sampleWanted(struct display *displays, int ndisplays,
+                         bool (*wants)(const struct display *d)) {
+	struct display *d, *o;
+	uint64_t t0, t;
+	int i;
+	bool ok = true;
+
+	for (i = 0; i < ndisplays; i++) {
+		d = &displays[i];
+		o = d->owner;
+		if (wants(d) && !o->inflight) {
+			xidle_sample_send(o->x);
+			o->inflight = true;
+		}
+	}
+	for (i = 0; i < ndisplays; i++) {
+		o = displays[i].owner;
+		if (!o->inflight)
+			continue;
+		t0 = nsNow();
+		if (!sampleRecv(o)) {
+			/* -W drops it with the next iteration, ioError() has said why */
+			if (o->lost)
+				continue;
+			fprintf(stderr, "%s: couldn't query screen saver info\n", o->name);
+			ok = false;
+			continue;
+		}
+		t = nsNow() - t0;
+		stats.samples++;
+		stats.queryTime += t;
+		if (t > stats.maxQuery)
+			stats.maxQuery = t;
+		countLatency(t);
+	}
+
+	return ok;
+}
+
+/*
+ * -a: sample the displays waiting on their alarm, which have no recent
+ * sample, for -D and --metrics. One that fails says so, the loop notices
+ * with its next poll.
+ */
+static void sampleWaiting(struct display *displays, int ndisplays) {
+	sampleWanted(displays, ndisplays, waitsOnAlarm);
+}
+
+/*!
+ * Sample all stale displays that still need samples, see sampleWanted().
+ *
+ * \return false if one of the displays couldn't be queried
+ */
+bool sampleAll(struct display *displays, int ndisplays) {
+	return sampleWanted(displays, ndisplays, wantsSample);
+}
+
+/*!
+ * The per sample output line. With -c it is only printed if the idle time
+ * went down, i.e. there was input, or moved into another bucket since the
+ * line printed last.
+ */
+void printIdle(const struct options *opts, struct display *d) {
+	/* -g sums the samples up instead */
+	if (opts->aggregate) {
+		summarizeSample(opts, d);
+		return;
+	}
+	if (opts->quiet)
+		return;
+
+	if (opts->bucket && d->printed && d->current >= d->last &&
+	    d->current / opts->bucket == d->last / opts->bucket)
+		return;
+	d->printed = true;
+	d->last = d->current;
+
+	if (opts->format != FORMAT_TEXT) {
+		emitRecord(opts, d, XIDLE_EVENT_SAMPLE, 0);
+		return;
+	}
+
+	if (opts->tag)
+		printf("%s ", d->name);
+	if (opts->verbose)
+		printf("%lu - %lu\n", time(NULL), d->current);
+	else
+		printf("%lu\n", d->current);
+}
+
+void printReached(const struct options *opts, const struct display *d) {
+	if (opts->onIdle)
+		runHook(opts->onIdle, d, "reached", opts->target);
+	if (opts->quiet)
+		return;
+
+	if (opts->format != FORMAT_TEXT) {
+		emitRecord(opts, d, XIDLE_EVENT_REACHED, opts->target);
+		return;
+	}
+
+	if (opts->tag)
+		printf("%s ", d->name);
+	printf("Reached idle target: %lu | timestamp: %lu\n", d->current, time(NULL));
+}
+
+/* -r: input on \a d ended an idle period of d->current ms */
+void printResumed(const struct options *opts, const struct display *d) {
+	if (opts->onResume)
+		runHook(opts->onResume, d, "resume", 0);
+	if (opts->quiet)
+		return;
+
+	if (opts->format != FORMAT_TEXT) {
+		emitRecord(opts, d, XIDLE_EVENT_RESUME, 0);
+		return;
+	}
+
+	if (opts->tag)
+		printf("%s ", d->name);
+	printf("Resumed after idle: %lu | timestamp: %lu\n", d->current, time(NULL));
+}
+
+/* \a s as the contents of a JSON string, the quotes are the caller's */
+void printJsonString(const char *s) {
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+}
+
+/*!
+ * Write one output line of the -o binary or json formats. The timestamps
+ * are those of the moment the idle time refers to: the server sample, or
+ * with -x the time it was extrapolated to.
+ */
+_Static_assert(sizeof(struct xidle_record) == 40, "xidle_record must stay 40 bytes");
+
+void emitRecord(const struct options *opts, const struct display *d, int event, unsigned long threshold) {
+	static const char *events[] = { "sample", "reached", "crossed", "reset", "resume" };
+	static const char *states[] = { "on", "standby", "suspend", "off" };
+	struct xidle_record r;
+	struct timespec mono, wall;
+	uint64_t mono_ns, wall_ns, age_ns;
+	uint16_t dpms = d->x ? xidle_dpms_state(d->x) : XIDLE_DPMS_UNKNOWN;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &wall);
+	mono_ns = d->sampled.tv_sec * 1000000000ULL + d->sampled.tv_nsec +
+		(d->current - d->base) * 1000000ULL;
+	age_ns = mono.tv_sec * 1000000000ULL + mono.tv_nsec - mono_ns;
+	wall_ns = wall.tv_sec * 1000000000ULL + wall.tv_nsec - age_ns;
+
+	if (opts->format == FORMAT_BINARY) {
+		memset(&r, 0, sizeof(r));
+		r.monotonic_ns = htole64(mono_ns);
+		r.wall_ns = htole64(wall_ns);
+		r.idle_ms = htole64(d->current);
+		r.threshold_ms = htole32(threshold);
+		r.dpms_state = htole16(dpms);
+		r.display = htole16(d->id);
+		r.event = htole16(event);
+		fwrite(&r, sizeof(r), 1, stdout);
+		if (!opts->flush)
+			fflush(stdout);
+		return;
+	}
+
+	printf("{\"display\":\"");
+	printJsonString(d->name);
+	printf("\",\"event\":\"%s\",\"monotonic_ns\":%llu,"
+	       "\"wall_ns\":%llu,\"idle_ms\":%lu,\"dpms\":\"%s\"",
+	       events[event], (unsigned long long) mono_ns,
+	       (unsigned long long) wall_ns, d->current,
+	       dpms < 4 ? states[dpms] : "unknown");
+	if (event == XIDLE_EVENT_CROSSED || event == XIDLE_EVENT_REACHED)
+		printf(",\"threshold_ms\":%lu", threshold);
+	printf("}\n");
+}
+
+/*!
+ * Compare the last sample of \a d against the thresholds of -t. Every
+ * threshold crossed since the previous sample gets its own line; if
+ * activity brought the idle time back below crossed thresholds, they are
+ * re-armed and, with -R, a reset line is printed.
+ *
+ * \param remaining the shortest time until any threshold can be crossed
+ *                  so far, in milliseconds
+ * \return \a remaining, lowered if a threshold of \a d is closer
+ */
+unsigned long checkThresholds(const struct options *opts, struct display *d, unsigned long remaining) {
+	unsigned long next;
+
+	if (d->crossed > 0 && d->current < opts->thresholds[d->crossed - 1]) {
+		while (d->crossed > 0 && d->current < opts->thresholds[d->crossed - 1])
+			d->crossed--;
+		if (opts->onResume)
+			runHook(opts->onResume, d, "reset", 0);
+		if (opts->resets && opts->format != FORMAT_TEXT)
+			emitRecord(opts, d, XIDLE_EVENT_RESET, 0);
+		else if (opts->resets) {
+			if (opts->tag)
+				printf("%s ", d->name);
+			printf("Reset idle: %lu | timestamp: %lu\n", d->current, time(NULL));
+		}
+	}
+
+	while (d->crossed < opts->nthresholds &&
+	       d->current >= opts->thresholds[d->crossed]) {
+		if (opts->format != FORMAT_TEXT)
+			emitRecord(opts, d, XIDLE_EVENT_CROSSED, opts->thresholds[d->crossed]);
+		else {
+			if (opts->tag)
+				printf("%s ", d->name);
+			printf("Crossed idle threshold: %lu | idle: %lu | timestamp: %lu\n",
+			       opts->thresholds[d->crossed], d->current, time(NULL));
+		}
+		if (opts->onIdle)
+			runHook(opts->onIdle, d, "crossed", opts->thresholds[d->crossed]);
+		d->crossed++;
+	}
+
+	next = d->crossed < opts->nthresholds ?
+		opts->thresholds[d->crossed] - d->current : ULONG_MAX;
+	if (d->crossed > 0 && next > opts->interval / 1000)
+		next = opts->interval / 1000;
+
+	return next < remaining ? next : remaining;
+}
+
+/*!
+ * The argv for a hook: \a cmd split at blanks, there is no quoting. With
+ * \a shell, /bin/sh -c \a cmd instead.
+ *
+ * \return NULL if \a cmd is blank
+ */
+char **splitCommand(const char *cmd, bool shell) {
+	char **argv, *copy, *word;
+	int n = 0;
+
+	argv = calloc(strlen(cmd) / 2 + 4, sizeof(*argv));
+	if (shell) {
+		argv[n++] = "/bin/sh";
+		argv[n++] = "-c";
+		argv[n++] = strdup(cmd);
+		return argv;
+	}
+	copy = strdup(cmd);
+	for (word = strtok(copy, " \t"); word; word = strtok(NULL, " \t"))
+		argv[n++] = word;
+	if (n == 0) {
+		free(copy);
+		free(argv);
+		return NULL;
+	}
+	return argv;
+}
+
+/*!
+ * Start the hook \a argv without waiting for it, it is reaped on SIGCHLD.
+ * The idle time, display, \a event and the crossed \a threshold are passed
+ * in XIDLE_IDLE_MS, XIDLE_DISPLAY, XIDLE_EVENT and XIDLE_THRESHOLD_MS.
+ */
+void runHook(char **argv, const struct display *d, const char *event, unsigned long threshold) {
+	extern char **environ;
+	char buf[24];
+	pid_t pid;
+	int err;
+
+	snprintf(buf, sizeof(buf), "%lu", d->current);
+	setenv("XIDLE_IDLE_MS", buf, 1);
+	snprintf(buf, sizeof(buf), "%lu", threshold);
+	setenv("XIDLE_THRESHOLD_MS", buf, 1);
+	setenv("XIDLE_DISPLAY", d->name, 1);
+	setenv("XIDLE_EVENT", event, 1);
+
+	/* stdout may be block buffered, the hook must not see our output twice */
+	fflush(stdout);
+	err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+	if (err)
+		fprintf(stderr, "%s: couldn't run %s: %s\n", d->name, argv[0], strerror(err));
+}
+
+/* collect all hooks that have finished */
+void reapHooks(void) {
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+}
+
+
+static int compareU64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* print min/median/p99/max of the \a n latencies in \a ns, sorting them */
+static void printLatencies(const struct options *opts, const char *what, uint64_t *ns, long n, bool last) {
+	uint64_t min, median, p99, max;
+
+	qsort(ns, n, sizeof(*ns), compareU64);
+	min = ns[0];
+	median = ns[n / 2];
+	p99 = ns[(n * 99 + 99) / 100 - 1];
+	max = ns[n - 1];
+
+	if (opts->format == FORMAT_JSON)
+		printf("\"%s\":{\"min_ns\":%llu,\"median_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}%s",
+		       what, (unsigned long long) min, (unsigned long long) median,
+		       (unsigned long long) p99, (unsigned long long) max, last ? "" : ",");
+	else
+		printf("  %-24s %10.1f %10.1f %10.1f %10.1f\n", what,
+		       min / 1000.0, median / 1000.0, p99 / 1000.0, max / 1000.0);
+}
+
+/* ns for connecting to \a name, one sample and closing, 0 on errors */
+static uint64_t benchStartup(const char *name, bool oneshot) {
+	struct display d;
+	uint64_t t0 = nsNow(), t;
+	bool ok;
+
+	if (!openDisplay(&d, name, oneshot)) {
+		/* attachDisplay() leaves a connection it couldn't use open */
+		if (d.dpy)
+			XCloseDisplay(d.dpy);
+		return 0;
+	}
+	ok = sampleAll(&d, 1);
+	xidle_close(d.x);
+	t = nsNow() - t0;
+	return ok ? t : 0;
+}
+
+/*!
+ * --bench N: take N samples back to back from every display and report the
+ * latency of the screen saver query and of the DPMS correction, the
+ * latter once with the cache of libxidle and once re-reading everything
+ * on every sample like it used to be, plus the requests and round trips a
+ * sample costs. With XCB, query and correction are a single pipelined
+ * round trip and are reported together. Last, the wall time of a whole -s
+ * from connecting to closing, once set up like the loop and once through
+ * the one-shot path.
+ *
+ * \return the exit status for main()
+ */
+int runBench(struct display *displays, int ndisplays, const struct options *opts) {
+	uint64_t *query, *cached, *uncached, *full, *oneshot, t0;
+	unsigned long requests, roundtrips;
+	long i, n = opts->bench;
+	int k, status = 1;
+
+	query = calloc(n, sizeof(*query));
+	cached = calloc(n, sizeof(*cached));
+	uncached = calloc(n, sizeof(*uncached));
+	full = calloc(n, sizeof(*full));
+	oneshot = calloc(n, sizeof(*oneshot));
+	if (!query || !cached || !uncached || !full || !oneshot) {
+		perror("runBench");
+		goto out;
+	}
+
+	for (k = 0; k < ndisplays; k++) {
+		struct display *d = &displays[k];
+#ifndef USE_XCB
+		XScreenSaverInfo ssi;
+		unsigned long before;
+		uint64_t t1, t2;
+		int dummy;
+
+		requests = 0;
+		for (i = 0; i < n; i++) {
+			before = XNextRequest(d->dpy);
+			t0 = nsNow();
+			if (!XScreenSaverQueryInfo(d->dpy, DefaultRootWindow(d->dpy), &ssi)) {
+				fprintf(stderr, "%s: couldn't query screen saver info\n", d->name);
+				goto out;
+			}
+			t1 = nsNow();
+			xidle_correct(d->x, ssi.idle);
+			t2 = nsNow();
+			requests += XNextRequest(d->dpy) - before;
+			query[i] = t1 - t0;
+			cached[i] = t2 - t1;
+		}
+		/* every request of a sample waits for its reply */
+		roundtrips = requests;
+
+		for (i = 0; i < n; i++) {
+			xidle_dpms_invalidate(d->x);
+			t0 = nsNow();
+			if (DPMSQueryExtension(d->dpy, &dummy, &dummy) && DPMSCapable(d->dpy))
+				xidle_correct(d->x, ssi.idle);
+			uncached[i] = nsNow() - t0;
+		}
+#else
+		unsigned long r0, t0r;
+
+		xidle_counters(d->x, &r0, &t0r);
+		for (i = 0; i < n; i++) {
+			d->stale = true;
+			t0 = nsNow();
+			xidle_sample_send(d->x);
+			if (!sampleRecv(d)) {
+				fprintf(stderr, "%s: couldn't query screen saver info\n", d->name);
+				goto out;
+			}
+			query[i] = nsNow() - t0;
+			cached[i] = 0;
+		}
+		xidle_counters(d->x, &requests, &roundtrips);
+		requests -= r0;
+		roundtrips -= t0r;
+		for (i = 0; i < n; i++) {
+			xidle_dpms_invalidate(d->x);
+			t0 = nsNow();
+			xidle_sample_send(d->x);
+			sampleRecv(d);
+			uncached[i] = nsNow() - t0;
+		}
+		d->stale = false;
+#endif
+
+		XkbIgnoreExtension(False);
+		for (i = 0; i < n; i++)
+			if (!(full[i] = benchStartup(d->name, false)))
+				goto out;
+		XkbIgnoreExtension(True);
+		for (i = 0; i < n; i++)
+			if (!(oneshot[i] = benchStartup(d->name, true)))
+				goto out;
+
+		if (opts->format == FORMAT_JSON) {
+			printf("{\"display\":\"");
+			printJsonString(d->name);
+			printf("\",\"samples\":%ld,\"backend\":\"%s\",", n, USE_XCB_NAME);
+			printLatencies(opts, "query", query, n, false);
+			printLatencies(opts, "dpms_cached", cached, n, false);
+			printLatencies(opts, "dpms_uncached", uncached, n, false);
+			printLatencies(opts, "oneshot_full", full, n, false);
+			printLatencies(opts, "oneshot", oneshot, n, false);
+			printf("\"requests_per_sample\":%.2f,\"round_trips_per_sample\":%.2f,"
+			       "\"dpms\":%s,\"dpms_notify\":%s}\n",
+			       (double) requests / n, (double) roundtrips / n,
+			       xidle_dpms_state(d->x) != XIDLE_DPMS_UNKNOWN ? "true" : "false",
+			       xidle_dpms_notify(d->x) ? "true" : "false");
+		} else {
+			printf("%s: %ld samples through %s, latency in microseconds\n",
+			       d->name, n, USE_XCB_NAME);
+			printf("  %-24s %10s %10s %10s %10s\n", "", "min", "median", "p99", "max");
+			printLatencies(opts, QUERY_NAME, query, n, false);
+			printLatencies(opts, "DPMS correction", cached, n, false);
+			printLatencies(opts, "DPMS uncached", uncached, n, false);
+			printLatencies(opts, "-s, full setup", full, n, false);
+			printLatencies(opts, "-s, one-shot path", oneshot, n, true);
+			printf("  requests per sample:    %.2f\n", (double) requests / n);
+			printf("  round trips per sample: %.2f\n", (double) roundtrips / n);
+			printf("  DPMS:                   %s\n",
+			       xidle_dpms_state(d->x) == XIDLE_DPMS_UNKNOWN ? "no" :
+			       xidle_dpms_notify(d->x) ? "power level changes notified" :
+			       "power level asked for every sample");
+		}
+	}
+
+	status = 0;
+out:
+	free(query);
+	free(cached);
+	free(uncached);
+	free(full);
+	free(oneshot);
+	return status;
+}
+
+/*!
+ * Where the files of -D and -M live: \a name in $XDG_RUNTIME_DIR, or if
+ * that isn't set in /tmp/xidletool-<uid>, a directory only the user may
+ * enter. It is created if needed; one that isn't the user's alone, made
+ * by someone else to answer for the daemon, is refused.
+ *
+ * \return the path, or NULL with the reason printed
+ */
+const char *runtimeFile(const char *name) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char priv[32], *path;
+	struct stat st;
+
+	if (!dir || !*dir) {
+		snprintf(priv, sizeof(priv), "/tmp/xidletool-%u", (unsigned) getuid());
+		if (mkdir(priv, 0700) < 0 && errno != EEXIST) {
+			perror(priv);
+			return NULL;
+		}
+		if (lstat(priv, &st) < 0 || !S_ISDIR(st.st_mode) ||
+		    st.st_uid != getuid() || (st.st_mode & 077)) {
+			fprintf(stderr, "%s isn't a directory of this user only, "
+			        "set XDG_RUNTIME_DIR or use -S\n", priv);
+			return NULL;
+		}
+		dir = priv;
+	}
+	path = malloc(strlen(dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static int connectSocket(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*!
+ * Create the listening socket of -D. A leftover socket file is replaced,
+ * unless another daemon still answers on it.
+ *
+ * \return the socket, or -1 with the reason printed
+ */
+int listenSocket(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = connectSocket(path);
+	if (fd >= 0) {
+		close(fd);
+		fprintf(stderr, "%s is in use by another daemon\n", path);
+		return -1;
+	}
+	unlink(path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0 ||
+	    bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, 64) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*!
+ * Answer all pending -s clients. Each one gets a line "<display> <idle>"
+ * per monitored display, taken from the last sample (extrapolated to now
+ * with -x), and is disconnected. Only the displays -a leaves waiting on
+ * their alarm, which have no recent sample, are asked for one.
+ */
+void serveClient(int lfd, struct display *displays, int ndisplays, bool extrapolate) {
+	struct timespec now;
+	char *buf;
+	size_t size = 0, len = 0;
+	int fd, i;
+
+	sampleWaiting(displays, ndisplays);
+	if (extrapolate) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < ndisplays; i++)
+			if (extrapolates(&displays[i]))
+				extrapolateIdle(&displays[i], &now);
+	}
+
+	for (i = 0; i < ndisplays; i++)
+		size += strlen(displays[i].name) + 24;
+	buf = malloc(size);
+	for (i = 0; i < ndisplays; i++)
+		len += snprintf(buf + len, size - len, "%s %lu\n",
+		                displays[i].name, displays[i].current);
+
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		/* the reply is small enough to always fit the socket buffer */
+		send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		close(fd);
+	}
+	free(buf);
+}
+
+/*!
+ * The client side of -D, used by -s: read the idle times from a running
+ * daemon and print those of the requested displays like a direct query
+ * would. A daemon of another user isn't believed, whoever created the
+ * socket.
+ *
+ * \param fallback the name asked for without -d, NULL if there is none
+ * \return false if there is no daemon or it doesn't monitor one of the
+ *         displays, the caller then queries the X server itself
+ */
+bool querySocket(const struct options *opts, const char **names, int nnames, const char *fallback) {
+	struct display *found;
+	char *buf = NULL, *grown, name[256], *line, *save = NULL;
+	size_t len = 0, size = 0;
+	ssize_t n;
+	unsigned long idle;
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	int fd, i, count = nnames ? nnames : 1;
+	bool ok = true;
+
+	if ((!nnames && !fallback) || !opts->socketPath)
+		return false;
+	fd = connectSocket(opts->socketPath);
+	if (fd < 0)
+		return false;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0 || cred.uid != getuid()) {
+		fprintf(stderr, "%s: not answered by a daemon of this user, ignored\n", opts->socketPath);
+		close(fd);
+		return false;
+	}
+	/* a line per display of the daemon, read up to its end */
+	do {
+		if (len + 1 >= size) {
+			size = size ? size * 2 : 4096;
+			if (!(grown = realloc(buf, size))) {
+				perror("querySocket");
+				free(buf);
+				close(fd);
+				return false;
+			}
+			buf = grown;
+		}
+		n = read(fd, buf + len, size - 1 - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	close(fd);
+	buf[len] = '\0';
+
+	found = calloc(count, sizeof(*found));
+	for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "%255s %lu", name, &idle) != 2)
+			continue;
+		for (i = 0; i < count; i++)
+			if (!found[i].name &&
+			    sameDisplay(name, nnames ? names[i] : fallback, true)) {
+				found[i].name = nnames ? names[i] : fallback;
+				found[i].id = i;
+				found[i].current = found[i].base = idle;
+				clock_gettime(CLOCK_MONOTONIC, &found[i].sampled);
+			}
+	}
+
+	for (i = 0; i < count; i++)
+		if (!found[i].name)
+			ok = false;
+	if (ok) {
+		struct options o = *opts;
+
+		o.tag = count > 1;
+		for (i = 0; i < count; i++)
+			printIdle(&o, &found[i]);
+	}
+	free(found);
+	free(buf);
+	return ok;
+}
+
+/*!
+ * Create the shared memory segment of -M with one record per display and
+ * hook the records up to \a displays. The file is set up under a temporary
+ * name and renamed into place, so readers never see it half initialized.
+ * The temporary file is always a new one of our own, never something a
+ * link there points to, and only the user can read the idle times.
+ *
+ * \return false with the reason printed if the file can't be created
+ */
+bool createShm(const char *path, struct display *displays, int ndisplays, uint16_t flags) {
+	struct xidle_shm *shm;
+	size_t size = sizeof(*shm) + ndisplays * sizeof(shm->records[0]);
+	char *tmp;
+	int fd, i;
+
+	tmp = malloc(strlen(path) + 5);
+	sprintf(tmp, "%s.tmp", path);
+	/* a leftover of a crash, unlink() removes a link itself */
+	unlink(tmp);
+	fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		perror(tmp);
+		free(tmp);
+		return false;
+	}
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		free(tmp);
+		return false;
+	}
+
+	shmFlags = flags;
+	shm->magic = XIDLE_SHM_MAGIC;
+	shm->count = ndisplays;
+	for (i = 0; i < ndisplays; i++) {
+		strncpy(shm->records[i].display, displays[i].name, XIDLE_SHM_NAMELEN - 1);
+		shm->records[i].dpms_state = XIDLE_DPMS_UNKNOWN;
+		shm->records[i].flags = flags;
+		displays[i].shm = &shm->records[i];
+	}
+
+	if (rename(tmp, path) < 0) {
+		perror(path);
+		free(tmp);
+		return false;
+	}
+	free(tmp);
+	return true;
+}
+
+/* write the last sample of \a d to its record using the seqlock protocol
+ * described in xidletool-shm.h */
+void publishSample(const struct display *d) {
+	struct xidle_shm_record *r = d->shm;
+	uint16_t flags = shmFlags;
+	uint32_t seq;
+
+	if (!r)
+		return;
+	/* a sample the activity alarm doesn't guard is replaced next tick */
+	if (!extrapolates(d))
+		flags &= ~XIDLE_SHM_EXTRAPOLATE;
+
+	seq = r->sequence;
+	__atomic_store_n(&r->sequence, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&r->idle_ms, d->base, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->sample_monotonic_ns,
+	                 d->sampled.tv_sec * 1000000000ULL + d->sampled.tv_nsec,
+	                 __ATOMIC_RELAXED);
+	__atomic_store_n(&r->dpms_state,
+	                 d->x ? xidle_dpms_state(d->x) : XIDLE_DPMS_UNKNOWN,
+	                 __ATOMIC_RELAXED);
+	__atomic_store_n(&r->flags, flags, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->sequence, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int compareThresholds(const void *a, const void *b) {
+	unsigned long x = *(const unsigned long *) a;
+	unsigned long y = *(const unsigned long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*!
+ * Parse the argument of -t, a single target or a comma separated list of
+ * thresholds in milliseconds.
+ *
+ * \return the number of thresholds, or -1 if \a arg is malformed
+ */
+int parseThresholds(char *arg, unsigned long **thresholds) {
+	char *tok, *end, *save = NULL;
+	int n = 0;
+
+	free(*thresholds);
+	*thresholds = NULL;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		*thresholds = realloc(*thresholds, (n + 1) * sizeof(**thresholds));
+		(*thresholds)[n] = strtoul(tok, &end, 10);
+		if (*end != '\0' || end == tok || (*thresholds)[n] == 0)
+			return -1;
+		n++;
+	}
+	if (n == 0)
+		return -1;
+
+	qsort(*thresholds, n, sizeof(**thresholds), compareThresholds);
+	return n;
+}
+
+/*!
+ * Install the signal handlers of the loops. The handler only passes the
+ * signal on to runLoop(), which handles it between two samples, never
+ * while a Display is in use.
+ *
+ * \return false with the reason printed if they can't be installed
+ */
+bool setupSignals(void) {
+	struct sigaction act;
+
+	if (pipe2(signalPipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return false;
+	}
+	memset(&act, '\0', sizeof(act));
+	act.sa_handler = signalToPipe;
+	act.sa_flags = SA_RESTART;
+	if (sigaction(SIGTERM, &act, NULL) < 0 || sigaction(SIGINT, &act, NULL) < 0 ||
+	    sigaction(SIGUSR1, &act, NULL) < 0 || sigaction(SIGUSR2, &act, NULL) < 0 ||
+	    sigaction(SIGCHLD, &act, NULL) < 0) {
+		perror ("sigaction");
+		return false;
+	}
+	return true;
+}
+
+/* hand \a sig over to the main loop, which is all that's safe in here */
+static void signalToPipe(int sig) {
+	int saved = errno;
+	unsigned char c = sig;
+
+	if (write(signalPipe[1], &c, 1) < 0) {
+		/* the pipe is full, the loop has enough to do already */
+	}
+	errno = saved;
+}
+
+void dumpStats(void) {
+	unsigned long requests = 0, roundtrips = 0, r, t;
+	int i;
+
+	/* libxidle counts the requests of the samples per display */
+	for (i = 0; i < nAllDisplays; i++) {
+		if (!allDisplays[i].x)
+			continue;
+		xidle_counters(allDisplays[i].x, &r, &t);
+		requests += r;
+		roundtrips += t;
+	}
+	fprintf(stderr, "samples: %lu | requests: %lu | round trips: %lu | "
+	        "wakeups: %lu | timer overruns: %lu | query time: %llu us | "
+	        "max query latency: %llu us\n",
+	        stats.samples, requests, roundtrips,
+	        stats.wakeups, stats.overruns,
+	        (unsigned long long) stats.queryTime / 1000,
+	        (unsigned long long) stats.maxQuery / 1000);
+}
+
+void usage(char *name)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"%s [-s] [-e] [-t target[,target...] [-a|-p] [-R]] [-i interval] [-A]\n"
+		"       [-d display]... [-D] [-S socket] [-M] [-x verify] [-X] [-c bucket]\n"
+		"       [-r] [-g window] [-b flush] [-o text|binary|json] [--bench N]\n"
+		"       [--on-idle CMD] [--on-resume CMD] [--shell] [-B backend] [-W]\n"
+		"       [--reconnect] [--metrics FILE] [-q] [-v]\n"
+		"  -s\n"
+		"       print the current idle time and exit, asks a running -D\n"
+		"       daemon first\n"
+		"  -e\n"
+		"       don't poll, print the idle time whenever the screen saver\n"
+		"       state changes (ignored with -s and -t)\n"
+		"  -r\n"
+		"       after the -t target, or right away without one, wait for the\n"
+		"       next input, print how long the user was idle and exit,\n"
+		"       with an IDLETIME alarm or else by polling every interval\n"
+		"  -A\n"
+		"       report every screen of the displays over their one connection,\n"
+		"       as display.screen\n"
+		"  -i interval (in milliseconds)\n"
+		"       check idle time every <interval> milliseconds\n"
+		"  -t target (in milliseconds)\n"
+		"       run until system has been idle for target milliseconds\n"
+		"       with a comma separated list, run indefinitely and print a line\n"
+		"       whenever the idle time crosses one of the thresholds\n"
+		"  -a\n"
+		"       wait for the target with an XSync IDLETIME alarm instead of\n"
+		"       polling every interval, falls back to polling if unavailable\n"
+		"  -p\n"
+		"       instead of every interval, check again when the target could\n"
+		"       be reached at the earliest, i.e. after target - idle time\n"
+		"  -R\n"
+		"       with several thresholds, also print a line when activity\n"
+		"       resets the idle time below crossed thresholds\n"
+		"  -d display\n"
+		"       monitor this display instead of $DISPLAY, may be repeated to\n"
+		"       monitor several displays, output lines are then prefixed\n"
+		"       with the display name\n"
+		"  -D\n"
+		"       keep running and answer -s on a unix socket with the last\n"
+		"       sampled idle time of every monitored display\n"
+		"  -S socket\n"
+		"       socket of -D and -s, default $XDG_RUNTIME_DIR/xidletool.sock\n"
+		"       or /tmp/xidletool-<uid>/xidletool.sock without it\n"
+		"  -M\n"
+		"       publish every sample in $XDG_RUNTIME_DIR/xidletool.shm for\n"
+		"       lock free readers, see xidletool-shm.h\n"
+		"  -x verify (in milliseconds)\n"
+		"       once the user has been idle for an interval, extrapolate\n"
+		"       the idle time from the last sample instead of asking the\n"
+		"       server every interval; a new sample is taken on input\n"
+		"       (noticed with an XSync alarm) or after verify ms\n"
+		"  -X\n"
+		"       notice input through XInput2 raw events instead, which resets\n"
+		"       the idle time without asking the server; implies -x 60000\n"
+		"  -W\n"
+		"       watch /tmp/.X11-unix and open every display whose socket\n"
+		"       appears there with the cookie of its server, dropping it when\n"
+		"       the socket or the server goes away; runs until terminated\n"
+		"  --reconnect\n"
+		"       when the server of a display goes away, open it again with a\n"
+		"       growing delay of up to 30 s instead of exiting\n"
+		"  -g window (in milliseconds)\n"
+		"       instead of the samples, print a summary of the idle periods\n"
+		"       every window (0 for only at the end and on SIGUSR1): their\n"
+		"       number, idle and active time, the longest and a histogram\n"
+		"       of their lengths in powers of two seconds\n"
+		"  --metrics FILE\n"
+		"       every interval, write the idle times, DPMS states and\n"
+		"       counters to FILE in the Prometheus text format, for the\n"
+		"       textfile collector of node_exporter; removed at the end\n"
+		"  -c bucket (in milliseconds)\n"
+		"       only print the idle time when input reset it or it moved on\n"
+		"       into the next multiple of bucket\n"
+		"  -b flush (in milliseconds)\n"
+		"       buffer the output and write it out at most every flush\n"
+		"       milliseconds instead of once per line\n"
+		"  -o format\n"
+		"       text (default), binary for fixed size struct xidle_record\n"
+		"       records (see xidletool-record.h) or json for one object per\n"
+		"       line, both include timestamps in nanoseconds and DPMS state\n"
+		"  --bench N\n"
+		"       take N samples back to back and report their latency and\n"
+		"       round trips, as text or with -o json\n"
+		"  --on-idle CMD\n"
+		"       run CMD whenever a -t threshold is crossed, the tool keeps\n"
+		"       running even with a single target\n"
+		"  --on-resume CMD\n"
+		"       run CMD whenever input resets the idle time below a crossed\n"
+		"       threshold, both get XIDLE_IDLE_MS, XIDLE_THRESHOLD_MS,\n"
+		"       XIDLE_DISPLAY and XIDLE_EVENT in their environment\n"
+		"  --shell\n"
+		"       run the hooks with /bin/sh -c, by default CMD is split at\n"
+		"       blanks and run directly\n"
+		"  -B backend\n"
+		"       x11 (default) to ask the X server, or one of the push\n"
+		"       backends built in: %s\n"
+		"       -d then names their seats (logind sessions, evdev devices),\n"
+		"       -e, -a, -p, -x and -X have no effect\n"
+		"  -q\n"
+		"       be quiet, don't print anything (only useful when in target mode),\n"
+		"       with several thresholds only the crossings are printed\n"
+		"  -v\n"
+		"       print timestamp and ideltime(default is only ideltime)\n"
+		"  -V\n"
+		"       show version and authors\n"
+		"\n"
+		"Note that -s and -t are mutually exclusive, only the last one matters.\n"
+		"By default, %s runs indefinitely with an interval of 1000 milliseconds.\n"
+		"The user's idle time in milliseconds is printed on stdout.\n"
+		"On SIGUSR1, counters of samples, round trips and wakeups are\n"
+		"printed on stderr, SIGUSR2 takes and prints a sample right away and\n"
+		"SIGTERM or SIGINT make it exit cleanly.\n",
+		name, backendNames(), name);
+}
+
+void thisVersion(char *name) {
+	printf(	"%s v. %s\n"
+		"\n"
+		"AUTHORS:\n"
+		"Copyright (c) 2005, 2008 Magnus Henoch <henoch@dtek.chalmers.se>\n"
+		"Copyright (c) 2006, 2007 by Danny Kukawka\n"
+		"                         <dkukawka@suse.de>, <danny.kukawka@web.de>\n"
+		"Copyright (c) 2008 Eivind Magnus Hvidevold <hvidevold@gmail.com>\n"
+		"Copyright (c) 2014 Alex Alexander\n"
+		"                   <wired@gentoo.org> <alex.alexander@gmail.com>\n"
+		"Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>\n",
+		name, VERSION);
+}
+
+/*!
+ * Collect the sample xidle_sample_send() has asked for on the connection
+ * of \a d and store it in the d->current of every entry of the connection
+ * that wants one or waits on its -a alarm.
+ *
+ * \return false if the screen saver info couldn't be queried
+ */
+bool sampleRecv(struct display *d) {
+	struct display *o = d->owner, *m;
+	struct timespec now;
+	uint64_t idle;
+	int k;
+
+	o->inflight = false;
+	if (xidle_sample_recv(o->x, &idle) < 0)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (k = 0; k < o->group; k++) {
+		m = o + k;
+		if (!wantsSample(m) && !waitsOnAlarm(m))
+			continue;
+		m->current = m->base = xidle_screen_idle(o->x, m->screen);
+		m->sampled = now;
+		m->stale = false;
+		publishSample(m);
+	}
+	return true;
 }
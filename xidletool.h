@@ -0,0 +1,235 @@
+/*
+
+xidletool.h, what the parts of xidletool share: options, the per display
+state and the output functions, used by the X loop in xidletool.c and the
+push backends run by xidletool-backend.c.
+
+Copyright (c) 2015 Markus Mr. <github-contact@mr-pi.de>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License
+as published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef XIDLETOOL_H
+#define XIDLETOOL_H
+
+#include <X11/Xlib.h>
+#include <X11/extensions/sync.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "xidle.h"
+#include "xidletool-shm.h"
+
+/* ms a polled sample must be below the expected idle time to count as input */
+#define RESUME_SLACK 10
+
+/* --metrics sample latency buckets, the last one is above all bounds */
+#define LATENCY_BUCKETS 12
+
+/* -g histogram: below 2 s, then one bucket per power of two seconds */
+#define SUMMARY_BUCKETS 24
+
+enum format {
+	FORMAT_TEXT,
+	FORMAT_BINARY,       /* struct xidle_record */
+	FORMAT_JSON,         /* one object per line */
+};
+
+struct options {
+	bool verbose;
+	bool quiet;
+	bool events;         /* -e, wait for ScreenSaverNotify */
+	bool alarm;          /* -a, wait for the target with an XSync alarm */
+	bool adaptive;       /* -p, sleep until the target could be reached */
+	bool tag;            /* prefix output lines with the display name */
+	bool watch;          /* -e without a target, only ScreenSaverNotify */
+	bool resets;         /* -R, report when activity resets the idle time */
+	bool resume;         /* -r, wait for the next input and exit */
+	bool screens;        /* -A, report every screen of a display */
+	long target;
+	unsigned long *thresholds;  /* -t with a list, sorted ascending */
+	int nthresholds;
+	unsigned long interval;  /* in microseconds */
+	bool daemon;         /* -D, serve the idle time on socketPath */
+	const char *socketPath;
+	bool publish;        /* -M, publish samples in shared memory */
+	const char *shmPath;
+	unsigned long verify;    /* -x, extrapolate and verify every verify ms */
+	bool rawInput;           /* -X, input resets the idle time through XInput2 */
+	unsigned long bucket;    /* -c, only print resets and bucket changes */
+	unsigned long flush;     /* -b, block buffer stdout, flush every ms */
+	enum format format;      /* -o */
+	long bench;              /* --bench, number of samples */
+	char **onIdle;           /* --on-idle, argv of the hook */
+	char **onResume;         /* --on-resume */
+	const struct backend *backend;  /* -B, NULL for the X server */
+	bool discover;           /* -W, watch the displays in /tmp/.X11-unix */
+	bool reconnect;          /* --reconnect, a lost display is opened again */
+	bool aggregate;          /* -g, print summaries instead of samples */
+	unsigned long window;    /* -g, ms of a summary, 0 for only at the end */
+	const char *metricsPath; /* --metrics, the Prometheus text file */
+};
+
+/* -g: the idle periods of one display in the current window */
+struct summary {
+	struct timespec started;     /* CLOCK_MONOTONIC the window began */
+	unsigned long periods;       /* idle periods that ended in the window */
+	unsigned long idle;          /* ms of idle time in the window */
+	unsigned long longest;       /* ms of the longest period that ended */
+	unsigned long histogram[SUMMARY_BUCKETS];
+	bool seeded;                 /* a sample has been seen */
+	unsigned long peak;          /* idle time of the ongoing period so far */
+	unsigned long counted;       /* ms of it in earlier windows, or before the run */
+};
+
+struct display {
+	const char *name;        /* display string, used to tag the output */
+	int id;                  /* position in the -d list */
+	struct xidle *x;         /* libxidle handle, owns dpy */
+	Display *dpy;
+	int event_basep;         /* screen saver event base */
+	int screen;              /* the root window reported on */
+	bool shared;             /* -A, dpy and x belong to owner */
+	struct display *owner;   /* the entry that reads dpy, maybe this one */
+	int group;               /* owner only, entries of dpy from here on */
+	bool inflight;           /* owner only, a sample has been sent */
+	XSyncAlarm alarm;        /* -a, fires at the target */
+	XSyncAlarm activity;     /* -x, fires on input after some idle time */
+	unsigned long noticed;   /* -x, idle time from which input is noticed at once */
+	int xiOpcode;            /* -X, owner only, XInputExtension opcode */
+	bool motionMuted;        /* -X, owner only, no RawMotion until the next tick */
+	unsigned long current;   /* idle time of the last sample, or extrapolated */
+	unsigned long base;      /* idle time the server reported at sampled */
+	struct timespec sampled; /* CLOCK_MONOTONIC of the last sample */
+	bool stale;              /* take a sample from the server next tick */
+	bool printed;            /* printIdle() has printed last */
+	unsigned long last;      /* the idle time printed last */
+	struct xidle_shm_record *shm;  /* -M record, or NULL */
+	bool reached;            /* the target has been reached */
+	int crossed;             /* number of thresholds crossed */
+	bool idle;               /* push backends: base and sampled are known */
+	bool resumed;            /* push backends: input ended an idle period */
+	void *seat;              /* push backends: their state of the entry */
+	bool lost;               /* -W, --reconnect: the server went away */
+	struct timespec retry;   /* --reconnect: when to open it again */
+	unsigned long backoff;   /* --reconnect: ms to wait after the next failure */
+	struct summary summary;  /* -g */
+};
+
+/*!
+ * A source of idle times that isn't an X server. These push: they tell
+ * when the user went idle or came back instead of being asked, so the
+ * loop in runBackend() only has to wake up for output and deadlines it
+ * can compute itself.
+ *
+ * open() fills in one display entry per seat (or session, or whatever
+ * the source reports on) and reports through backendIdle() and
+ * backendActive() from then on. Idle times below \a resolution ms may go
+ * unnoticed, a source that only learns of them at a timeout uses it.
+ * A source whose entries come and go marks those that went away lost in
+ * dispatch() or flush(), entries() then drops them and adds the new ones.
+ * flush() also handles what the source has read already, so the loop
+ * computes its deadlines from it before it waits again.
+ */
+struct backend {
+	const char *name;        /* for -B */
+	const char *seat;        /* the entry -s asks a daemon for without -d */
+	bool sample;             /* open() already knows the idle times, for -s */
+	int (*open)(const struct options *opts, const char **names, int nnames,
+	            unsigned long resolution, struct display **displays);
+	int (*fd)(void);         /* polled for dispatch() */
+	bool (*flush)(void);     /* each iteration before the deadlines, may be NULL */
+	bool (*dispatch)(void);  /* the fd is readable, false on fatal errors */
+	int (*entries)(struct display **displays);  /* after flush(), may be NULL */
+	void (*close)(void);
+};
+
+/* runtime counters, dumped to stderr on SIGUSR1 */
+struct stats {
+	unsigned long samples;
+	unsigned long wakeups;     /* returns from poll() */
+	unsigned long overruns;    /* timer expirations that were missed */
+	uint64_t queryTime;        /* ns spent waiting for samples */
+	uint64_t maxQuery;         /* ns of the slowest sample */
+	unsigned long latency[LATENCY_BUCKETS + 1];  /* samples per latency bucket */
+};
+
+void usage(char *name);
+void thisVersion(char *name);
+bool openDisplay(struct display *d, const char *name, bool oneshot);
+bool attachDisplay(struct display *d, Display *dpy, bool oneshot);
+struct display *findDisplay(const char *name);
+bool addDisplay(struct display *d, const struct options *opts);
+void displayLost(Display *dpy, void *data);
+bool sampleRecv(struct display *d);
+bool sampleAll(struct display *displays, int ndisplays);
+int expandScreens(struct display **displays, int ndisplays);
+struct display *eventTarget(struct display *d, XEvent *ev, XSyncAlarm alarm);
+void dumpStats(void);
+int runLoop(const struct options *opts);
+int waitResume(struct display *displays, int ndisplays, const struct options *opts);
+bool handleXEvents(struct display *d, const struct options *opts);
+bool openRawInput(struct display *d);
+void selectRawInput(struct display *d, bool motion);
+void rawInput(struct display *d, XEvent *ev);
+void extrapolateIdle(struct display *d, const struct timespec *now);
+bool extrapolates(const struct display *d);
+void printIdle(const struct options *opts, struct display *d);
+void printReached(const struct options *opts, const struct display *d);
+void printResumed(const struct options *opts, const struct display *d);
+void printJsonString(const char *s);
+void emitRecord(const struct options *opts, const struct display *d, int event, unsigned long threshold);
+int runBench(struct display *displays, int ndisplays, const struct options *opts);
+int parseThresholds(char *arg, unsigned long **thresholds);
+const char *runtimeFile(const char *name);
+int listenSocket(const char *path);
+void serveClient(int lfd, struct display *displays, int ndisplays, bool extrapolate);
+bool createShm(const char *path, struct display *displays, int ndisplays, uint16_t flags);
+void publishSample(const struct display *d);
+bool querySocket(const struct options *opts, const char **names, int nnames, const char *fallback);
+unsigned long checkThresholds(const struct options *opts, struct display *d, unsigned long remaining);
+char **splitCommand(const char *cmd, bool shell);
+void runHook(char **argv, const struct display *d, const char *event, unsigned long threshold);
+void reapHooks(void);
+bool setupSignals(void);
+uint64_t nsNow(void);
+unsigned long msSince(const struct timespec *then, const struct timespec *now);
+void timespecAddUs(struct timespec *ts, unsigned long us);
+void armTimer(int tfd, const struct timespec *deadline, unsigned long interval);
+
+const struct backend *findBackend(const char *name);
+const char *backendNames(void);
+int runBackend(const struct backend *b, const struct options *opts, const char **names, int nnames);
+void backendIdle(struct display *d, unsigned long idle, const struct timespec *at);
+void backendActive(struct display *d, const struct timespec *at);
+
+void summarizeSample(const struct options *opts, struct display *d);
+void printSummary(const struct options *opts, struct display *d, const struct timespec *now, bool restart);
+void printSummaries(const struct options *opts, struct display *displays, int ndisplays, bool restart);
+
+void countLatency(uint64_t ns);
+void writeMetrics(const struct options *opts, const struct display *displays, int ndisplays);
+int metricsTimer(const struct options *opts);
+
+int discoverStart(void);
+void discoverDispatch(const struct options *opts);
+void discoverStop(void);
+
+extern const struct backend waylandBackend;   /* xidletool-wayland.c */
+extern const struct backend logindBackend;    /* xidletool-logind.c */
+extern const struct backend evdevBackend;     /* xidletool-evdev.c */
+
+extern struct stats stats;
+extern int signalPipe[2];
+extern bool terminated;
+
+#endif